@@ -0,0 +1,371 @@
+// Throughput/latency benchmark of the whole Engine on synthetic order flow.
+//
+// Each simulated client is a thread that stands in for a ClientConnection: it
+// generates its commands up front and submits them to the Engine one read at a
+// time, the way connection threads do, but without a socket. Latency is
+// measured from just before a command is handed to the engine to the first
+// output event it causes. Engine settings (mode, matchers, timestamp source...)
+// come from the ENGINE_* environment variables; output is redirected to the
+// benchmark, so async output is not used. Results are printed as one JSON object.
+//
+// Build from matching-engine/ with `make benches`, then:
+//   build/engine_bench --instruments=8 --clients=4 --commands=200000 --cancel-pct=20
+//   build/engine_bench --aggressive-pct=50 --partial-fill-pct=30
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "engine.hpp"
+#include "event_journal.hpp"
+
+namespace {
+
+struct BenchConfig {
+    // instrument names are SYM<n>, at most 8 characters
+    static constexpr uint32_t max_instruments = 100000;
+
+    uint32_t instruments = 4;
+    uint32_t clients = 4;
+    // per client
+    uint32_t commands = 100000;
+    // the rest are sells
+    uint32_t buy_pct = 40;
+    uint32_t cancel_pct = 20;
+    uint32_t mid_price = 10000;
+    // standard deviation of limit prices around the mid
+    double price_stddev = 20.0;
+    // share of orders priced to cross the mid, i.e. to trade with resting orders
+    uint32_t aggressive_pct = 30;
+    // When set, aggressive orders are sized against the resting quantity they cross:
+    // this share of them exceeds it and rests the remainder after a partial fill,
+    // the others fill completely. Unset (-1), every count is random up to max_count.
+    int32_t partial_fill_pct = -1;
+    uint32_t max_count = 100;
+    uint32_t seed = 1;
+
+    bool parse(const char* arg) {
+        auto value = [arg](const char* name) -> const char* {
+            size_t len = std::strlen(name);
+            return std::strncmp(arg, name, len) == 0 && arg[len] == '=' ? arg + len + 1 : nullptr;
+        };
+        if (const char* v = value("--instruments")) instruments = std::clamp<uint32_t>(std::atoi(v), 1, max_instruments);
+        else if (const char* v = value("--clients")) clients = std::atoi(v);
+        else if (const char* v = value("--commands")) commands = std::atoi(v);
+        else if (const char* v = value("--buy-pct")) buy_pct = std::atoi(v);
+        else if (const char* v = value("--cancel-pct")) cancel_pct = std::atoi(v);
+        else if (const char* v = value("--mid-price")) mid_price = std::atoi(v);
+        else if (const char* v = value("--price-stddev")) price_stddev = std::atof(v);
+        else if (const char* v = value("--aggressive-pct")) aggressive_pct = std::atoi(v);
+        else if (const char* v = value("--partial-fill-pct")) partial_fill_pct = std::atoi(v);
+        else if (const char* v = value("--max-count")) max_count = std::atoi(v);
+        else if (const char* v = value("--seed")) seed = std::atoi(v);
+        else return false;
+        return true;
+    }
+};
+
+// submit time of the command that created each order id, and of the cancel of it;
+// swapped to 0 by the first event for it so every command is counted once
+std::vector<std::atomic<int64_t>> order_submit_ns;
+std::vector<std::atomic<int64_t>> cancel_submit_ns;
+
+std::mutex latencies_mut;
+std::vector<std::vector<int64_t>*> all_latencies;
+std::atomic<uint64_t> num_events{0};
+
+thread_local std::vector<int64_t>* thread_latencies = nullptr;
+
+int64_t nowNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+
+void recordLatency(std::atomic<int64_t>& submit_ns) {
+    int64_t submitted = submit_ns.exchange(0, std::memory_order_relaxed);
+    if (submitted == 0) {
+        return;
+    }
+    if (thread_latencies == nullptr) {
+        thread_latencies = new std::vector<int64_t>();
+        std::scoped_lock lock(latencies_mut);
+        all_latencies.push_back(thread_latencies);
+    }
+    thread_latencies->push_back(nowNs() - submitted);
+}
+
+void onEvent(const EventRecord& record, void*) {
+    num_events.fetch_add(1, std::memory_order_relaxed);
+    switch (record.type) {
+        case EventType::OrderAdded:
+            recordLatency(order_submit_ns[record.order_id]);
+            break;
+        case EventType::OrderExecuted:
+            recordLatency(order_submit_ns[record.active_order_id]);
+            break;
+        case EventType::OrderDeleted:
+            if (record.order_id < cancel_submit_ns.size()) {
+                recordLatency(cancel_submit_ns[record.order_id]);
+            }
+            break;
+    }
+}
+
+// Resting orders as the generated flow would leave them if the clients' commands
+// arrived interleaved one by one, to size aggressive orders against the depth they
+// cross. The engine sees the clients race, so this is an approximation.
+class ShadowBook {
+    struct Resting {
+        uint32_t instrument;
+        bool buy;
+        uint32_t price;
+        uint32_t count;
+    };
+    using Side = std::map<uint32_t, std::deque<uint32_t>>;
+
+    // per instrument, price -> order ids in time priority
+    std::vector<Side> buys;
+    std::vector<Side> sells;
+    std::unordered_map<uint32_t, Resting> resting;
+
+   public:
+    explicit ShadowBook(uint32_t instruments) : buys(instruments), sells(instruments) {}
+
+    // resting quantity an order would cross, counted up to limit
+    uint64_t crossable(uint32_t instrument, bool buy, uint32_t price, uint64_t limit) const {
+        uint64_t quantity = 0;
+        forCrossed(instrument, buy, price, [&](uint32_t order_id) {
+            quantity += resting.at(order_id).count;
+            return quantity < limit;
+        });
+        return quantity;
+    }
+
+    void add(uint32_t instrument, bool buy, uint32_t order_id, uint32_t price, uint32_t count) {
+        Side& opposite = buy ? sells[instrument] : buys[instrument];
+        forCrossed(instrument, buy, price, [&](uint32_t resting_id) {
+            Resting& order = resting.at(resting_id);
+            uint32_t filled = std::min(order.count, count);
+            order.count -= filled;
+            count -= filled;
+            if (order.count == 0) {
+                removeFromLevel(opposite, resting_id, order.price);
+            }
+            return count > 0;
+        });
+        if (count > 0) {
+            resting[order_id] = Resting{instrument, buy, price, count};
+            (buy ? buys : sells)[instrument][price].push_back(order_id);
+        }
+    }
+
+    void cancel(uint32_t order_id) {
+        auto it = resting.find(order_id);
+        if (it != resting.end()) {
+            removeFromLevel(it->second.buy ? buys[it->second.instrument] : sells[it->second.instrument], order_id,
+                            it->second.price);
+        }
+    }
+
+   private:
+    // calls f(order_id) on crossed orders in priority order while it returns true;
+    // f may remove the order it was called with
+    template <typename F>
+    void forCrossed(uint32_t instrument, bool buy, uint32_t price, F f) const {
+        if (buy) {
+            const Side& asks = sells[instrument];
+            for (auto level = asks.begin(); level != asks.end() && level->first <= price;) {
+                auto next = std::next(level);
+                if (!forLevel(level->second, f)) {
+                    return;
+                }
+                level = next;
+            }
+        } else {
+            const Side& bids = buys[instrument];
+            for (auto level = bids.rbegin(); level != bids.rend() && level->first >= price;) {
+                uint32_t level_price = level->first;
+                if (!forLevel(level->second, f)) {
+                    return;
+                }
+                // erasing the level invalidates the reverse iterator, find the next one again
+                level = std::make_reverse_iterator(bids.lower_bound(level_price));
+            }
+        }
+    }
+
+    template <typename F>
+    static bool forLevel(const std::deque<uint32_t>& order_ids, F& f) {
+        // copied, f may empty the level
+        std::deque<uint32_t> ids = order_ids;
+        for (uint32_t order_id : ids) {
+            if (!f(order_id)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    void removeFromLevel(Side& side, uint32_t order_id, uint32_t price) {
+        auto level = side.find(price);
+        std::erase(level->second, order_id);
+        if (level->second.empty()) {
+            side.erase(level);
+        }
+        resting.erase(order_id);
+    }
+};
+
+// Command generator of one client; order ids are dense across clients, each
+// order is cancelled at most once.
+class ClientFlow {
+    const BenchConfig& config;
+    std::mt19937 rng;
+    std::normal_distribution<double> price_offset;
+    std::vector<uint32_t> cancellable;
+    uint32_t next_order_id;
+
+   public:
+    ClientFlow(const BenchConfig& config, uint32_t client)
+        : config(config),
+          rng(config.seed * 7919 + client),
+          price_offset(0.0, config.price_stddev),
+          next_order_id(client * config.commands + 1) {}
+
+    ClientCommand next(ShadowBook& book) {
+        ClientCommand command{};
+        if (rng() % 100 < config.cancel_pct && !cancellable.empty()) {
+            size_t idx = rng() % cancellable.size();
+            command.type = input_cancel;
+            command.order_id = cancellable[idx];
+            cancellable[idx] = cancellable.back();
+            cancellable.pop_back();
+            book.cancel(command.order_id);
+            return command;
+        }
+
+        bool buy = rng() % 100 < config.buy_pct * 100 / std::max(1u, 100 - config.cancel_pct);
+        bool aggressive = rng() % 100 < config.aggressive_pct;
+        double offset = std::abs(price_offset(rng)) + 1;
+        // passive orders rest on their own side of the mid, aggressive ones cross it
+        double price = buy == aggressive ? config.mid_price + offset : config.mid_price - offset;
+        command.type = buy ? input_buy : input_sell;
+        command.order_id = next_order_id++;
+        command.price = std::max(1.0, std::round(price));
+        command.count = 1 + rng() % config.max_count;
+        uint32_t instrument = rng() % config.instruments;
+        std::snprintf(command.instrument, sizeof(command.instrument), "SYM%u", instrument % BenchConfig::max_instruments);
+        if (aggressive && config.partial_fill_pct >= 0) {
+            uint64_t depth = book.crossable(instrument, buy, command.price, config.max_count);
+            if (depth > 0 && rng() % 100 < static_cast<uint32_t>(config.partial_fill_pct)) {
+                command.count = depth + 1 + rng() % config.max_count;
+            } else if (depth > 0) {
+                command.count = 1 + rng() % depth;
+            }
+        }
+        book.add(instrument, buy, command.order_id, command.price, command.count);
+        cancellable.push_back(command.order_id);
+        return command;
+    }
+};
+
+// all clients' commands, generated in the interleaving the shadow book assumes
+std::vector<std::vector<ClientCommand>> generateFlows(const BenchConfig& config) {
+    ShadowBook book(config.instruments);
+    std::vector<ClientFlow> generators;
+    std::vector<std::vector<ClientCommand>> flows(config.clients);
+    for (uint32_t client = 0; client < config.clients; ++client) {
+        generators.emplace_back(config, client);
+        flows[client].reserve(config.commands);
+    }
+    for (uint32_t i = 0; i < config.commands; ++i) {
+        for (uint32_t client = 0; client < config.clients; ++client) {
+            flows[client].push_back(generators[client].next(book));
+        }
+    }
+    return flows;
+}
+
+int64_t percentile(const std::vector<int64_t>& sorted, double p) {
+    if (sorted.empty()) {
+        return 0;
+    }
+    size_t idx = std::min(sorted.size() - 1, static_cast<size_t>(p * sorted.size()));
+    return sorted[idx];
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    BenchConfig config;
+    for (int i = 1; i < argc; ++i) {
+        if (!config.parse(argv[i])) {
+            std::fprintf(stderr, "unknown argument %s\n", argv[i]);
+            return 1;
+        }
+    }
+
+    std::vector<std::vector<ClientCommand>> flows = generateFlows(config);
+    size_t num_ids = size_t(config.clients) * config.commands + 1;
+    order_submit_ns = std::vector<std::atomic<int64_t>>(num_ids);
+    cancel_submit_ns = std::vector<std::atomic<int64_t>>(num_ids);
+
+    EventJournal::redirect(onEvent, nullptr);
+    EngineConfig engine_config = EngineConfig::fromEnvironment();
+    engine_config.async_output = false;
+    Engine engine(engine_config);
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> clients;
+    for (uint32_t client = 0; client < config.clients; ++client) {
+        clients.emplace_back([&engine, &flow = flows[client]] {
+            ClientState state;
+            for (ClientCommand& command : flow) {
+                auto& submit_ns = command.type == input_cancel ? cancel_submit_ns : order_submit_ns;
+                submit_ns[command.order_id].store(nowNs(), std::memory_order_relaxed);
+                engine.submit(std::span<ClientCommand>(&command, 1), state);
+            }
+        });
+    }
+    for (std::thread& client : clients) {
+        client.join();
+    }
+    // single-writer matchers may still be working through their rings
+    engine.drain();
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    EventJournal::redirect(nullptr, nullptr);
+
+    std::vector<int64_t> latencies;
+    for (std::vector<int64_t>* thread_latencies : all_latencies) {
+        latencies.insert(latencies.end(), thread_latencies->begin(), thread_latencies->end());
+    }
+    std::sort(latencies.begin(), latencies.end());
+    uint64_t total_commands = uint64_t(config.clients) * config.commands;
+
+    std::printf("{\"instruments\": %u, \"clients\": %u, \"commands_per_client\": %u, \"buy_pct\": %u, "
+                "\"cancel_pct\": %u, \"price_stddev\": %.1f, \"aggressive_pct\": %u, \"partial_fill_pct\": %d, "
+                "\"seed\": %u,\n",
+                config.instruments, config.clients, config.commands, config.buy_pct, config.cancel_pct,
+                config.price_stddev, config.aggressive_pct, config.partial_fill_pct, config.seed);
+    std::printf(" \"seconds\": %.6f, \"commands_per_sec\": %.0f, \"events\": %llu, \"latency_samples\": %zu,\n",
+                seconds, total_commands / seconds, static_cast<unsigned long long>(num_events.load()), latencies.size());
+    std::printf(" \"latency_ns\": {\"p50\": %lld, \"p99\": %lld, \"p99_9\": %lld, \"max\": %lld}}\n",
+                static_cast<long long>(percentile(latencies, 0.5)),
+                static_cast<long long>(percentile(latencies, 0.99)),
+                static_cast<long long>(percentile(latencies, 0.999)),
+                static_cast<long long>(latencies.empty() ? 0 : latencies.back()));
+    return 0;
+}
@@ -0,0 +1,152 @@
+// Microbenchmark for resting order storage: bytes per resting order and match
+// throughput of OrderBook, against the original layout (48-byte Order copied
+// through a std::priority_queue, with liveness in an unordered_map).
+//
+// Build from matching-engine/ with `make benches`, then:
+//   build/order_storage_bench [resting_orders]
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <queue>
+#include <random>
+#include <unordered_map>
+#include <vector>
+
+#include "event_journal.hpp"
+#include "order_book.hpp"
+
+namespace {
+
+// Order as it was before the hot/cold split.
+struct LegacyOrder {
+    CommandType type;
+    uint32_t order_id;
+    uint32_t price;
+    uint32_t count;
+    char instrument[9];
+    uint32_t execution_id;
+    intmax_t timestamp;
+
+    bool operator<(const LegacyOrder& other) const {
+        if (price != other.price) return price > other.price;
+        return timestamp > other.timestamp;
+    }
+};
+
+struct LegacyBook {
+    std::priority_queue<LegacyOrder> resting_orders;
+    std::unordered_map<uint32_t, bool> executed_orders;
+
+    void add(const ClientCommand& command) {
+        LegacyOrder order{command.type, command.order_id, command.price, command.count, {}, 0, getCurrentTimestamp()};
+        std::memcpy(order.instrument, command.instrument, sizeof(order.instrument));
+        resting_orders.push(order);
+        executed_orders[command.order_id] = false;
+    }
+
+    // same steps as the original match loop: copy the top, pop, push the updated copy
+    void match(ClientCommand& command) {
+        while (command.count > 0 && !resting_orders.empty()) {
+            LegacyOrder top = resting_orders.top();
+            if (top.price > command.price) {
+                return;
+            }
+            resting_orders.pop();
+            uint32_t qty = std::min(top.count, command.count);
+            command.count -= qty;
+            top.count -= qty;
+            top.execution_id += 1;
+            if (top.count == 0) {
+                executed_orders[top.order_id] = true;
+            } else {
+                resting_orders.push(top);
+            }
+        }
+    }
+
+    size_t bytes() const {
+        // vector storage plus one node and one bucket per map entry
+        return resting_orders.size() * sizeof(LegacyOrder) +
+               executed_orders.size() * (sizeof(std::pair<const uint32_t, bool>) + 2 * sizeof(void*)) +
+               executed_orders.bucket_count() * sizeof(void*);
+    }
+};
+
+void discardEvent(const EventRecord&, void*) {}
+
+ClientCommand makeCommand(CommandType type, uint32_t order_id, uint32_t price, uint32_t count) {
+    ClientCommand command{};
+    command.type = type;
+    command.order_id = order_id;
+    command.price = price;
+    command.count = count;
+    std::memcpy(command.instrument, "BENCH", 6);
+    return command;
+}
+
+double secondsSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    size_t num_resting = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 1000000;
+    EventJournal::redirect(discardEvent, nullptr);
+
+    std::mt19937 rng(42);
+    std::vector<ClientCommand> sells;
+    std::vector<ClientCommand> buys;
+    uint32_t next_id = 1;
+    uint64_t total_qty = 0;
+    for (size_t i = 0; i < num_resting; ++i) {
+        uint32_t count = 1 + rng() % 100;
+        total_qty += count;
+        sells.push_back(makeCommand(input_sell, next_id++, 1000 + rng() % 500, count));
+    }
+    // aggressive buys that partially fill a few resting orders each until the book is empty
+    while (total_qty > 0) {
+        uint32_t count = std::min<uint64_t>(total_qty, 1 + rng() % 150);
+        total_qty -= count;
+        buys.push_back(makeCommand(input_buy, next_id++, 2000, count));
+    }
+
+    LegacyBook legacy;
+    auto start = std::chrono::steady_clock::now();
+    for (const ClientCommand& sell : sells) {
+        legacy.add(sell);
+    }
+    double legacy_add_seconds = secondsSince(start);
+    size_t legacy_bytes = legacy.bytes();
+    start = std::chrono::steady_clock::now();
+    for (ClientCommand buy : buys) {
+        legacy.match(buy);
+    }
+    double legacy_match_seconds = secondsSince(start);
+
+    char instrument[9] = "BENCH";
+    uint64_t next_sequence = 0;
+    OrderBook book(input_sell, 0, instrument, next_sequence);
+    start = std::chrono::steady_clock::now();
+    for (const ClientCommand& sell : sells) {
+        book.addOrder(sell);
+    }
+    double add_seconds = secondsSince(start);
+    size_t bytes = book.livenessStats().bytes;
+    // the engine's matching path: one sweep fills everything a buy crosses
+    std::vector<Execution> executions;
+    start = std::chrono::steady_clock::now();
+    for (const ClientCommand& buy : buys) {
+        executions.clear();
+        book.sweep(buy, executions);
+    }
+    double match_seconds = secondsSince(start);
+
+    std::printf("{\"resting_orders\": %zu, \"aggressive_orders\": %zu,\n", num_resting, buys.size());
+    std::printf(" \"legacy\": {\"bytes_per_resting_order\": %.1f, \"adds_per_sec\": %.0f, \"matches_per_sec\": %.0f},\n",
+                double(legacy_bytes) / num_resting, num_resting / legacy_add_seconds, buys.size() / legacy_match_seconds);
+    std::printf(" \"pooled\": {\"bytes_per_resting_order\": %.1f, \"adds_per_sec\": %.0f, \"matches_per_sec\": %.0f}}\n",
+                double(bytes) / num_resting, num_resting / add_seconds, buys.size() / match_seconds);
+    return 0;
+}
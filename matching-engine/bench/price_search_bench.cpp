@@ -0,0 +1,143 @@
+// Microbenchmark for the price ladder searches: the AVX2 and scalar PriceSearch
+// kernels against the std::lower_bound that findLevel used before, on both sides
+// of the book, for ladders of different depths and for prices that land near the
+// top or anywhere in the book.
+//
+// Before timing, every kernel is checked query by query against lower_bound on
+// ladders of every size up to a few blocks past the AVX2 scan window, so sizes
+// below, at and one past a multiple of the 8 wide blocks and of the scan window
+// are all covered, with bounds below, on, between and above every level.
+//
+// Build from matching-engine/ with `make benches`, then:
+//   build/price_search_bench [queries]
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <random>
+#include <vector>
+
+#include "price_search.hpp"
+
+namespace {
+
+// a buy ladder ascends towards its best (highest) price at the back, a sell
+// ladder descends towards its best (lowest) one
+std::vector<uint32_t> makeLadder(size_t depth, bool buy) {
+    std::vector<uint32_t> prices(depth);
+    for (size_t i = 0; i < depth; ++i) {
+        uint32_t offset = 3 * static_cast<uint32_t>(i);
+        prices[i] = buy ? 100000 + offset : 100000 - offset;
+    }
+    return prices;
+}
+
+size_t lowerBoundAtLeast(const uint32_t* prices, size_t n, uint32_t bound) {
+    return prices + n - std::lower_bound(prices, prices + n, bound);
+}
+
+size_t lowerBoundAtMost(const uint32_t* prices, size_t n, uint32_t bound) {
+    return prices + n - std::lower_bound(prices, prices + n, bound, std::greater<uint32_t>());
+}
+
+PriceSearch::Kernel referenceFor(bool buy) { return buy ? lowerBoundAtLeast : lowerBoundAtMost; }
+
+PriceSearch::Kernel kernelFor(bool buy) { return buy ? PriceSearch::suffixAtLeast : PriceSearch::suffixAtMost; }
+
+// bounds on, just below and just above every level, and the extremes
+bool checkLadder(const std::vector<uint32_t>& prices, bool buy, const char* kernel) {
+    std::vector<uint32_t> bounds = {0, 0xffffffff};
+    for (uint32_t price : prices) {
+        bounds.insert(bounds.end(), {price - 1, price, price + 1});
+    }
+    for (uint32_t bound : bounds) {
+        size_t expected = referenceFor(buy)(prices.data(), prices.size(), bound);
+        size_t got = kernelFor(buy)(prices.data(), prices.size(), bound);
+        if (got != expected) {
+            std::fprintf(stderr, "%s %s: %zu levels, bound %u: %zu, expected %zu\n", kernel,
+                         buy ? "suffixAtLeast" : "suffixAtMost", prices.size(), bound, got, expected);
+            return false;
+        }
+    }
+    return true;
+}
+
+bool checkKernel(const char* kernel) {
+    bool ok = true;
+    for (bool buy : {true, false}) {
+        for (size_t depth = 0; depth <= 200; ++depth) {
+            ok = checkLadder(makeLadder(depth, buy), buy, kernel) && ok;
+        }
+        for (size_t depth : {255, 256, 257, 1023, 1024, 1025}) {
+            ok = checkLadder(makeLadder(depth, buy), buy, kernel) && ok;
+        }
+        // the extremes of the unsigned compare
+        ok = checkLadder(buy ? std::vector<uint32_t>{0, 1, 0xfffffffe, 0xffffffff}
+                             : std::vector<uint32_t>{0xffffffff, 0xfffffffe, 1, 0},
+                         buy, kernel) &&
+             ok;
+    }
+    return ok;
+}
+
+double nsPerQuery(const std::vector<uint32_t>& prices, const std::vector<uint32_t>& queries,
+                  PriceSearch::Kernel search, size_t& checksum) {
+    auto start = std::chrono::steady_clock::now();
+    size_t sum = 0;
+    for (uint32_t query : queries) {
+        sum += search(prices.data(), prices.size(), query);
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    checksum = sum;
+    return seconds * 1e9 / queries.size();
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    size_t num_queries = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 2000000;
+    std::mt19937 rng(7);
+
+    PriceSearch::select(false);
+    bool ok = checkKernel("scalar");
+    if (PriceSearch::avx2Supported()) {
+        PriceSearch::select(true);
+        ok = checkKernel("avx2") && ok;
+    }
+
+    std::printf("{\"avx2_supported\": %s, \"results\": [\n", PriceSearch::avx2Supported() ? "true" : "false");
+    bool first = true;
+    for (bool buy : {true, false}) {
+        for (size_t depth : {8, 32, 128, 1024, 8192}) {
+            std::vector<uint32_t> prices = makeLadder(depth, buy);
+            for (bool near_top : {true, false}) {
+                // near the top: crossing/inserting within the best 16 levels
+                size_t span = near_top ? std::min<size_t>(depth, 16) : depth;
+                std::uniform_int_distribution<size_t> level(0, span);
+                std::vector<uint32_t> queries(num_queries);
+                for (uint32_t& query : queries) {
+                    uint32_t offset = 3 * static_cast<uint32_t>(level(rng)) - 1;
+                    query = buy ? prices.back() - offset : prices.back() + offset;
+                }
+
+                size_t lower_bound_sum, scalar_sum, avx2_sum = 0;
+                double lower_bound_ns = nsPerQuery(prices, queries, referenceFor(buy), lower_bound_sum);
+                PriceSearch::select(false);
+                double scalar_ns = nsPerQuery(prices, queries, kernelFor(buy), scalar_sum);
+                PriceSearch::select(true);
+                double avx2_ns = nsPerQuery(prices, queries, kernelFor(buy), avx2_sum);
+                ok = ok && scalar_sum == lower_bound_sum && avx2_sum == lower_bound_sum;
+
+                std::printf("%s {\"side\": \"%s\", \"depth\": %zu, \"near_top\": %s, \"lower_bound_ns\": %.2f, "
+                            "\"scalar_ns\": %.2f, \"avx2_ns\": %.2f}",
+                            first ? "" : ",\n", buy ? "buy" : "sell", depth, near_top ? "true" : "false",
+                            lower_bound_ns, scalar_ns, PriceSearch::avx2Selected() ? avx2_ns : 0.0);
+                first = false;
+            }
+        }
+    }
+    std::printf("],\n \"results_match\": %s}\n", ok ? "true" : "false");
+    return ok ? 0 : 1;
+}
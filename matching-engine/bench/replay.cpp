@@ -0,0 +1,48 @@
+// Replays a command capture (see ENGINE_CAPTURE) through the matching code on a
+// single thread and writes the canonical event stream, e.g. to reproduce an
+// incident or to diff the output of two builds:
+//   build/replay capture.bin events.txt    (- for stdout, omit to only time matching)
+// Replay statistics are printed to stderr as JSON.
+//
+// Built from matching-engine/ by `make benches`.
+
+#include <cstdio>
+#include <cstring>
+
+#include "command_capture.hpp"
+#include "replay.hpp"
+
+int main(int argc, char** argv) {
+    if (argc < 2 || argc > 3) {
+        std::fprintf(stderr, "usage: %s <capture> [events|-]\n", argv[0]);
+        return 1;
+    }
+
+    CaptureFile capture;
+    if (!capture.open(argv[1])) {
+        return 1;
+    }
+
+    FILE* events_out = nullptr;
+    if (argc == 3) {
+        events_out = std::strcmp(argv[2], "-") == 0 ? stdout : std::fopen(argv[2], "wb");
+        if (events_out == nullptr) {
+            std::fprintf(stderr, "cannot open %s\n", argv[2]);
+            return 1;
+        }
+    }
+
+    Replay replay;
+    ReplayStats stats = replay.run(capture.commands(), events_out);
+    if (events_out != nullptr) {
+        std::fflush(events_out);
+        if (events_out != stdout) {
+            std::fclose(events_out);
+        }
+    }
+
+    std::fprintf(stderr, "{\"commands\": %llu, \"events\": %llu, \"seconds\": %.6f, \"commands_per_sec\": %.0f}\n",
+                 static_cast<unsigned long long>(stats.commands), static_cast<unsigned long long>(stats.events),
+                 stats.seconds, stats.seconds > 0 ? stats.commands / stats.seconds : 0.0);
+    return 0;
+}
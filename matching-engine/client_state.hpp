@@ -0,0 +1,13 @@
+#ifndef CLIENT_STATE_HPP
+#define CLIENT_STATE_HPP
+
+#include <cstdint>
+
+// What the engine keeps per client connection between its commands, owned by
+// whatever reads the connection. Starts out value-initialised.
+struct ClientState {
+    // single-writer mode: matcher the client's last command was routed to
+    uint32_t last_matcher = 0;
+};
+
+#endif
@@ -0,0 +1,29 @@
+#include "clock.hpp"
+
+#include <chrono>
+#include <thread>
+
+void Clock::select(TimestampSource new_source) {
+    if (timestamp_source_fixed) {
+        new_source = fixed_timestamp_source;
+    }
+    if (new_source == TimestampSource::Tsc && tsc.ns_per_tick == 0) {
+        calibrateTsc();
+    }
+    source.store(new_source, std::memory_order_relaxed);
+}
+
+// measures the TSC rate against CLOCK_MONOTONIC over a few milliseconds
+void Clock::calibrateTsc() {
+#if ENGINE_HAS_TSC
+    int64_t start_ns = readClock(CLOCK_MONOTONIC);
+    uint64_t start_ticks = __rdtsc();
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    int64_t end_ns = readClock(CLOCK_MONOTONIC);
+    uint64_t end_ticks = __rdtsc();
+
+    tsc.ns_per_tick = (static_cast<unsigned __int128>(end_ns - start_ns) << 32) / (end_ticks - start_ticks);
+    tsc.base_ticks = end_ticks;
+    tsc.base_ns = end_ns;
+#endif
+}
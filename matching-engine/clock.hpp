@@ -0,0 +1,85 @@
+#ifndef CLOCK_HPP
+#define CLOCK_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <ctime>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define ENGINE_HAS_TSC 1
+#else
+#define ENGINE_HAS_TSC 0
+#endif
+
+// Where output timestamps come from. Timestamps are only reported, time priority
+// in the books comes from per-instrument sequence numbers.
+enum class TimestampSource : uint8_t {
+    // std::chrono::steady_clock, nanoseconds
+    SteadyClock,
+    // CLOCK_MONOTONIC_COARSE: no hardware read, but only advances once per tick
+    CoarseClock,
+    // calibrated rdtsc, falls back to SteadyClock where there is no TSC
+    Tsc,
+};
+
+// Build with -DENGINE_TIMESTAMP_SOURCE=Tsc (or SteadyClock, CoarseClock) to fix
+// the source at compile time; otherwise it is picked at start with Clock::select().
+#ifdef ENGINE_TIMESTAMP_SOURCE
+constexpr bool timestamp_source_fixed = true;
+constexpr TimestampSource fixed_timestamp_source = TimestampSource::ENGINE_TIMESTAMP_SOURCE;
+#else
+constexpr bool timestamp_source_fixed = false;
+constexpr TimestampSource fixed_timestamp_source = TimestampSource::SteadyClock;
+#endif
+
+class Clock {
+    // zero until calibrated (static storage)
+    struct TscCalibration {
+        uint64_t base_ticks;
+        int64_t base_ns;
+        // nanoseconds per tick in 32.32 fixed point
+        uint64_t ns_per_tick;
+    };
+
+    static inline std::atomic<TimestampSource> source{fixed_timestamp_source};
+    static inline TscCalibration tsc;
+
+   public:
+    // not meant to be called while other threads take timestamps;
+    // calibrates the TSC the first time it is selected
+    static void select(TimestampSource new_source);
+
+    static TimestampSource selected() {
+        return timestamp_source_fixed ? fixed_timestamp_source : source.load(std::memory_order_relaxed);
+    }
+
+    // nanoseconds on a monotonic clock
+    static int64_t now() noexcept {
+        switch (selected()) {
+            case TimestampSource::CoarseClock:
+                return readClock(CLOCK_MONOTONIC_COARSE);
+            case TimestampSource::Tsc:
+#if ENGINE_HAS_TSC
+                return tsc.base_ns + static_cast<int64_t>(
+                    (static_cast<unsigned __int128>(__rdtsc() - tsc.base_ticks) * tsc.ns_per_tick) >> 32);
+#else
+                [[fallthrough]];
+#endif
+            case TimestampSource::SteadyClock:
+                break;
+        }
+        return readClock(CLOCK_MONOTONIC);
+    }
+
+   private:
+    static int64_t readClock(clockid_t clock_id) noexcept {
+        timespec ts;
+        clock_gettime(clock_id, &ts);
+        return static_cast<int64_t>(ts.tv_sec) * 1'000'000'000 + ts.tv_nsec;
+    }
+
+    static void calibrateTsc();
+};
+
+#endif
@@ -0,0 +1,82 @@
+#include "command_capture.hpp"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstring>
+
+bool CommandCapture::open(const std::string& path) {
+    std::scoped_lock lock(mut);
+    file = std::fopen(path.c_str(), "wb");
+    if (file == nullptr) {
+        return false;
+    }
+    CaptureHeader header{};
+    std::memcpy(header.magic, capture_magic, sizeof(header.magic));
+    header.command_size = sizeof(ClientCommand);
+    std::fwrite(&header, sizeof(header), 1, file);
+    return true;
+}
+
+void CommandCapture::append(std::span<const ClientCommand> commands) {
+    std::scoped_lock lock(mut);
+    if (file != nullptr) {
+        std::fwrite(commands.data(), sizeof(ClientCommand), commands.size(), file);
+    }
+}
+
+void CommandCapture::close() {
+    std::scoped_lock lock(mut);
+    if (file != nullptr) {
+        std::fclose(file);
+        file = nullptr;
+    }
+}
+
+CaptureFile::~CaptureFile() {
+    if (base != nullptr) {
+        munmap(base, mapped_size);
+    }
+}
+
+bool CaptureFile::open(const std::string& path) {
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        SyncCerr() << "Failed to open capture " << path << std::endl;
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < sizeof(CaptureHeader)) {
+        SyncCerr() << "Capture " << path << " has no header" << std::endl;
+        ::close(fd);
+        return false;
+    }
+    mapped_size = st.st_size;
+    void* mapped = mmap(nullptr, mapped_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (mapped == MAP_FAILED) {
+        SyncCerr() << "Failed to map capture " << path << std::endl;
+        mapped_size = 0;
+        return false;
+    }
+    base = mapped;
+    // replay reads the capture front to back exactly once
+    madvise(base, mapped_size, MADV_SEQUENTIAL);
+    madvise(base, mapped_size, MADV_WILLNEED);
+
+    const auto* header = static_cast<const CaptureHeader*>(base);
+    if (std::memcmp(header->magic, capture_magic, sizeof(capture_magic)) != 0 ||
+        header->command_size != sizeof(ClientCommand)) {
+        SyncCerr() << "Capture " << path << " was not written by a build with this command layout" << std::endl;
+        return false;
+    }
+    size_t num_commands = (mapped_size - sizeof(CaptureHeader)) / sizeof(ClientCommand);
+    if (num_commands * sizeof(ClientCommand) != mapped_size - sizeof(CaptureHeader)) {
+        SyncCerr() << "Capture " << path << " ends with a partial command, ignoring it" << std::endl;
+    }
+    mapped_commands = std::span<const ClientCommand>(
+        reinterpret_cast<const ClientCommand*>(static_cast<const char*>(base) + sizeof(CaptureHeader)), num_commands);
+    return true;
+}
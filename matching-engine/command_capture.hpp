@@ -0,0 +1,53 @@
+#ifndef COMMAND_CAPTURE_HPP
+#define COMMAND_CAPTURE_HPP
+
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <span>
+#include <string>
+
+#include "io.hpp"
+
+// Binary capture of client commands: a CaptureHeader followed by raw
+// ClientCommands in the order they reached the engine. The header records the
+// command size so a capture is not replayed by a build with another layout.
+struct CaptureHeader {
+    char magic[8];
+    uint32_t command_size;
+    uint32_t reserved;
+};
+
+inline constexpr char capture_magic[8] = {'M', 'E', 'C', 'A', 'P', 'T', '1', '\0'};
+
+// Appends commands to a capture file, shared by every connection.
+class CommandCapture {
+    std::mutex mut;
+    FILE* file = nullptr;
+
+   public:
+    ~CommandCapture() { close(); }
+
+    bool open(const std::string& path);
+    void append(std::span<const ClientCommand> commands);
+    void close();
+};
+
+// Read-only memory mapping of a capture file, commands are used in place.
+class CaptureFile {
+    void* base = nullptr;
+    size_t mapped_size = 0;
+    std::span<const ClientCommand> mapped_commands;
+
+   public:
+    CaptureFile() = default;
+    CaptureFile(const CaptureFile&) = delete;
+    CaptureFile& operator=(const CaptureFile&) = delete;
+    ~CaptureFile();
+
+    // reports why through SyncCerr on failure
+    bool open(const std::string& path);
+    std::span<const ClientCommand> commands() const { return mapped_commands; }
+};
+
+#endif
@@ -1,84 +1,616 @@
 #include "engine.hpp"
 
+#include <bit>
+#include <cstdlib>
+#include <functional>
 #include <iostream>
+#include <sstream>
+#include <string_view>
 #include <thread>
 
 #include "instrument_orders.hpp"
 #include "io.hpp"
+#include "trace.hpp"
 
-// std::unordered_map<uint32_t, bool> OrderBook::executed_orders;
-// std::mutex OrderBook::hashmap_mut;
+namespace {
+
+std::vector<int> parseCpuList(const char* cpu_list) {
+    std::vector<int> cpus;
+    std::stringstream stream(cpu_list);
+    std::string cpu;
+    while (std::getline(stream, cpu, ',')) {
+        cpus.push_back(std::atoi(cpu.c_str()));
+    }
+    return cpus;
+}
+
+}  // namespace
+
+EngineConfig EngineConfig::fromEnvironment() {
+    EngineConfig config;
+    if (const char* mode = std::getenv("ENGINE_MODE")) {
+        if (std::strcmp(mode, "single_writer") == 0) {
+            config.mode = Mode::SingleWriter;
+        } else if (std::strcmp(mode, "locked") != 0) {
+            SyncCerr() << "Unknown ENGINE_MODE " << mode << ", using locked" << std::endl;
+        }
+    }
+    if (const char* num_matchers = std::getenv("ENGINE_MATCHERS")) {
+        config.num_matchers = std::max(1, std::atoi(num_matchers));
+    }
+    if (const char* matcher_cpus = std::getenv("ENGINE_MATCHER_CPUS")) {
+        config.matcher_cpus = parseCpuList(matcher_cpus);
+    }
+    if (const char* num_io_workers = std::getenv("ENGINE_IO_WORKERS")) {
+        config.num_io_workers = std::max(0, std::atoi(num_io_workers));
+    }
+    if (const char* placement = std::getenv("ENGINE_PLACEMENT")) {
+        if (std::strcmp(placement, "numa") == 0) {
+            config.numa_placement = true;
+        } else if (std::strcmp(placement, "hash") != 0) {
+            SyncCerr() << "Unknown ENGINE_PLACEMENT " << placement << ", using hash" << std::endl;
+        }
+    }
+    if (const char* rebalance_interval = std::getenv("ENGINE_REBALANCE_MS")) {
+        config.rebalance_interval = std::chrono::milliseconds(std::max(0, std::atoi(rebalance_interval)));
+    }
+    if (const char* rebalance_imbalance = std::getenv("ENGINE_REBALANCE_IMBALANCE")) {
+        config.rebalance_imbalance = std::max(0.0, std::atof(rebalance_imbalance));
+    }
+    if (const char* io_worker_cpus = std::getenv("ENGINE_IO_WORKER_CPUS")) {
+        config.io_worker_cpus = parseCpuList(io_worker_cpus);
+    }
+    if (const char* async_output = std::getenv("ENGINE_ASYNC_OUTPUT")) {
+        config.async_output = std::atoi(async_output) != 0;
+    }
+    if (const char* journal_path = std::getenv("ENGINE_JOURNAL")) {
+        config.journal_path = journal_path;
+    }
+    if (const char* trace_path = std::getenv("ENGINE_TRACE_FILE")) {
+        config.trace_path = trace_path;
+    }
+    if (const char* timestamp_source = std::getenv("ENGINE_TIMESTAMP_SOURCE")) {
+        if (std::strcmp(timestamp_source, "steady") == 0) {
+            config.timestamp_source = TimestampSource::SteadyClock;
+        } else if (std::strcmp(timestamp_source, "coarse") == 0) {
+            config.timestamp_source = TimestampSource::CoarseClock;
+        } else if (std::strcmp(timestamp_source, "tsc") == 0) {
+            config.timestamp_source = TimestampSource::Tsc;
+        } else {
+            SyncCerr() << "Unknown ENGINE_TIMESTAMP_SOURCE " << timestamp_source << std::endl;
+        }
+    }
+    if (const char* capture_path = std::getenv("ENGINE_CAPTURE")) {
+        config.capture_path = capture_path;
+    }
+    if (const char* depth_updates = std::getenv("ENGINE_DEPTH_UPDATES")) {
+        config.depth_update_capacity = std::max(0, std::atoi(depth_updates));
+    }
+    if (const char* lock_timing = std::getenv("ENGINE_LOCK_TIMING")) {
+        config.lock_timing = std::atoi(lock_timing) != 0;
+    }
+    if (const char* stats_path = std::getenv("ENGINE_STATS_FILE")) {
+        config.stats_path = stats_path;
+    }
+    if (const char* stats_interval = std::getenv("ENGINE_STATS_INTERVAL_MS")) {
+        config.stats_interval = std::chrono::milliseconds(std::max(1, std::atoi(stats_interval)));
+    }
+    if (const char* persistence_dir = std::getenv("ENGINE_PERSISTENCE_DIR")) {
+        config.persistence_dir = persistence_dir;
+    }
+    if (const char* snapshot_interval = std::getenv("ENGINE_SNAPSHOT_INTERVAL_MS")) {
+        config.snapshot_interval = std::chrono::milliseconds(std::max(1, std::atoi(snapshot_interval)));
+    }
+    if (const char* wal_flush_interval = std::getenv("ENGINE_WAL_FLUSH_US")) {
+        config.wal_flush_interval = std::chrono::microseconds(std::max(1, std::atoi(wal_flush_interval)));
+    }
+    return config;
+}
+
+Engine::Engine() : Engine(EngineConfig::fromEnvironment()) {}
+
+Engine::Engine(EngineConfig config)
+    : config(std::move(config)), instruments(this->config.max_instruments) {
+    Clock::select(this->config.timestamp_source);
+    HotPathStats::enableLockTiming(this->config.lock_timing);
+    MarketDepth::update_ring_capacity =
+        this->config.depth_update_capacity > 0 ? std::bit_ceil(this->config.depth_update_capacity) : 0;
+    if (!this->config.capture_path.empty() && !capture.open(this->config.capture_path)) {
+        SyncCerr() << "Failed to open command capture " << this->config.capture_path << std::endl;
+    }
+    if (this->config.async_output) {
+        EventJournal::start(EventJournal::Options{.journal_path = this->config.journal_path});
+    }
+    if (this->config.mode == EngineConfig::Mode::SingleWriter) {
+        CpuTopology topology = CpuTopology::detect();
+        std::vector<int> cpus = this->config.matcher_cpus;
+        if (this->config.numa_placement && cpus.empty()) {
+            cpus = topology.spread(this->config.num_matchers);
+        }
+        std::vector<int> matcher_nodes;
+        for (size_t i = 0; i < this->config.num_matchers; ++i) {
+            int cpu = i < cpus.size() ? cpus[i] : -1;
+            matchers.push_back(std::make_unique<Matcher>(this->config.matcher_ring_capacity, cpu));
+            matcher_nodes.push_back(cpu < 0 ? -1 : topology.nodeOf(cpu));
+        }
+        placement = std::make_unique<InstrumentPlacement>(std::move(matcher_nodes));
+        rebalancing = this->config.rebalance_interval.count() > 0 && matchers.size() > 1;
+    }
+    if (!this->config.persistence_dir.empty()) {
+        persistence = std::make_unique<Persistence>(
+            Persistence::Options{.dir = this->config.persistence_dir,
+                                 .snapshot_interval = this->config.snapshot_interval,
+                                 .wal_flush_interval = this->config.wal_flush_interval},
+            instruments,
+            [this](const char* instrument) -> InstrumentOrders& { return get_instrument_orders(instrument); },
+            [this](InstrumentOrders& instrument_orders, const std::function<void()>& f) { with_books(instrument_orders, f); });
+        persistence->start();
+    }
+    if (this->config.num_io_workers > 0) {
+        io_workers = std::make_unique<IoWorkerPool>(
+            this->config.num_io_workers, this->config.io_worker_cpus,
+            [this](std::span<ClientCommand> commands, ClientState& client) { handle_commands(commands, client); });
+    }
+    if (!this->config.stats_path.empty()) {
+        stats_thread = std::thread(&Engine::stats_loop, this);
+    }
+    if (rebalancing) {
+        rebalance_thread = std::thread(&Engine::rebalance_loop, this);
+    }
+}
+
+Engine::~Engine() {
+    stop();
+}
 
 void Engine::accept(ClientConnection connection) {
+    if (io_workers) {
+        io_workers->add(std::move(connection));
+        return;
+    }
+
+    {
+        std::scoped_lock lock(connections_mut);
+        if (!accepting) {
+            return;     // the connection is closed when it goes out of scope
+        }
+        ++active_connections;
+    }
     auto thread =
         std::thread(&Engine::connection_thread, this, std::move(connection));
     thread.detach();
 }
 
+void Engine::drain() {
+    {
+        std::unique_lock<std::mutex> lock(connections_mut);
+        accepting = false;
+        connections_cv.wait(lock, [this] { return active_connections == 0; });
+    }
+    if (io_workers) {
+        io_workers->drain();
+    }
+    stop_rebalance();
+    for (auto& matcher : matchers) {
+        matcher->stop();
+    }
+    if (persistence) {
+        persistence->stop();
+    }
+    EventJournal::stop();
+    capture.close();
+    stop_stats();
+    dump_trace();
+}
+
+void Engine::stop() {
+    {
+        std::scoped_lock lock(connections_mut);
+        accepting = false;
+    }
+    if (io_workers) {
+        io_workers->stop();
+    } else {
+        // detached connection threads block in readInput and cannot be interrupted,
+        // so without I/O workers stopping has to wait for clients to disconnect
+        std::unique_lock<std::mutex> lock(connections_mut);
+        connections_cv.wait(lock, [this] { return active_connections == 0; });
+    }
+    stop_rebalance();
+    for (auto& matcher : matchers) {
+        matcher->stop();
+    }
+    if (persistence) {
+        persistence->stop();
+    }
+    EventJournal::stop();
+    capture.close();
+    stop_stats();
+    dump_trace();
+}
+
+OrderStateStats Engine::order_state_stats() {
+    OrderStateStats stats;
+    for (uint32_t instrument_id = 0; instrument_id < instruments.size(); ++instrument_id) {
+        stats.books += instruments.get(instrument_id).liveness_stats();
+    }
+    stats.directory = InstrumentOrders::directory_stats();
+    return stats;
+}
+
+HotPathStatsSnapshot Engine::hot_path_stats() {
+    HotPathStatsSnapshot stats = HotPathStats::snapshot();
+    stats.instruments.resize(instruments.size());
+    return stats;
+}
+
+void Engine::stats_loop() {
+    FILE* file = std::fopen(config.stats_path.c_str(), "w");
+    if (file == nullptr) {
+        SyncCerr() << "Failed to open stats file " << config.stats_path << std::endl;
+        return;
+    }
+    std::unique_lock<std::mutex> lock(stats_mut);
+    while (!stats_cv.wait_for(lock, config.stats_interval, [this] { return stats_stopping; })) {
+        write_stats(file);
+    }
+    // final totals, after everything was matched when stopping through drain()
+    write_stats(file);
+    std::fclose(file);
+}
+
+void Engine::stop_stats() {
+    {
+        std::scoped_lock lock(stats_mut);
+        stats_stopping = true;
+    }
+    stats_cv.notify_all();
+    if (stats_thread.joinable()) {
+        stats_thread.join();
+    }
+}
+
+void Engine::write_stats(FILE* file) {
+    HotPathStatsSnapshot stats = hot_path_stats();
+    auto write_counters = [file](const HotPathStatsSnapshot::Counters& counters) {
+        for (size_t c = 0; c < num_hot_path_counters; ++c) {
+            std::fprintf(file, "%s\"%s\": %llu", c == 0 ? "" : ", ", counterName(static_cast<HotPathCounter>(c)),
+                         static_cast<unsigned long long>(counters[c]));
+        }
+    };
+    auto write_histogram = [file](const char* name, const DurationHistogram& histogram) {
+        std::fprintf(file, "\"%s_p50_ns\": %llu, \"%s_p99_ns\": %llu, \"%s_ns\": [", name,
+                     static_cast<unsigned long long>(histogram.quantile(0.5)), name,
+                     static_cast<unsigned long long>(histogram.quantile(0.99)), name);
+        for (size_t b = 0; b < DurationHistogram::num_buckets; ++b) {
+            std::fprintf(file, "%s%llu", b == 0 ? "" : ",", static_cast<unsigned long long>(histogram.buckets[b]));
+        }
+        std::fprintf(file, "]");
+    };
+
+    std::fprintf(file, "{\"timestamp\": %lld, \"totals\": {", static_cast<long long>(getCurrentTimestamp()));
+    write_counters(stats.totals);
+    std::fprintf(file, "}, \"instruments\": {");
+    bool first = true;
+    for (uint32_t instrument_id = 0; instrument_id < stats.instruments.size(); ++instrument_id) {
+        const auto& counters = stats.instruments[instrument_id];
+        if (counters[static_cast<size_t>(HotPathCounter::Orders)] == 0 &&
+            counters[static_cast<size_t>(HotPathCounter::CancelsAccepted)] == 0 &&
+            counters[static_cast<size_t>(HotPathCounter::CancelsRejected)] == 0) {
+            continue;
+        }
+        std::fprintf(file, "%s\"%s\": {", first ? "" : ", ", instruments.get(instrument_id).name());
+        write_counters(counters);
+        std::fprintf(file, "}");
+        first = false;
+    }
+    std::fprintf(file, "}");
+    if (config.lock_timing) {
+        std::fprintf(file, ", \"locks\": {");
+        for (size_t kind = 0; kind < num_lock_kinds; ++kind) {
+            std::fprintf(file, "%s\"%s\": {\"acquisitions\": %llu, ", kind == 0 ? "" : ", ",
+                         lockKindName(static_cast<LockKind>(kind)),
+                         static_cast<unsigned long long>(stats.locks[kind].hold.count()));
+            write_histogram("wait", stats.locks[kind].wait);
+            std::fprintf(file, ", ");
+            write_histogram("hold", stats.locks[kind].hold);
+            std::fprintf(file, "}");
+        }
+        std::fprintf(file, "}");
+    }
+    std::fprintf(file, "}\n");
+    std::fflush(file);
+}
+
+bool Engine::depth_snapshot(const char* instrument, DepthSnapshot& buy, DepthSnapshot& sell) {
+    InstrumentOrders* instrument_orders = instruments.find(instrument);
+    if (instrument_orders == nullptr) {
+        return false;
+    }
+    buy = instrument_orders->market_depth(input_buy).snapshot();
+    sell = instrument_orders->market_depth(input_sell).snapshot();
+    return true;
+}
+
+bool Engine::poll_level_updates(const char* instrument, std::vector<LevelUpdate>& updates) {
+    InstrumentOrders* instrument_orders = instruments.find(instrument);
+    if (instrument_orders == nullptr) {
+        return false;
+    }
+    LevelUpdate update;
+    for (CommandType side : {input_buy, input_sell}) {
+        while (instrument_orders->market_depth(side).pollUpdate(update)) {
+            updates.push_back(update);
+        }
+    }
+    return true;
+}
+
+void Engine::dump_trace() {
+    if constexpr (ENGINE_TRACE_LEVEL > 0) {
+        if (config.trace_path.empty()) {
+            return;
+        }
+        if (FILE* file = std::fopen(config.trace_path.c_str(), "wb")) {
+            Trace::dump(file);
+            std::fclose(file);
+        }
+    }
+}
+
 void Engine::connection_thread(ClientConnection connection) {
+    ClientState client;
     while (true) {
         ClientCommand input{};
         switch (connection.readInput(input)) {
             case ReadResult::Error:
                 SyncCerr{} << "Error reading input" << std::endl;
+                [[fallthrough]];
             case ReadResult::EndOfFile:
+                connection_ended();
                 return;
             case ReadResult::Success:
                 break;
         }
+        handle_commands(std::span<ClientCommand>(&input, 1), client);
+    }
+}
 
-        // Functions for printing output actions in the prescribed format are
-        // provided in the Output class:
-        switch (input.type) {
-            case input_cancel: {
-                // SyncCerr{} << "Got cancel: ID: " << input.order_id << std::endl;
-
-                // Remember to take timestamp at the appropriate time, or
-                // compute an appropriate timestamp!
-                // auto output_time = getCurrentTimestamp();
-                // Output::OrderDeleted(input.order_id, true, output_time);
+void Engine::connection_ended() {
+    std::scoped_lock lock(connections_mut);
+    --active_connections;
+    connections_cv.notify_all();
+}
 
-                SyncCerr() << "Cancel command" << std::endl;
-                InstrumentOrders::handle_cancel_command(input);
+void Engine::handle_commands(std::span<ClientCommand> commands, ClientState& client) {
+    if (!config.capture_path.empty()) {
+        capture.append(commands);
+    }
+    if (config.mode == EngineConfig::Mode::SingleWriter) {
+        for (ClientCommand& input : commands) {
+            route_command(input, client);
+        }
+        return;
+    }
 
-                break;
+    // consecutive orders for one instrument are matched as a batch; a cancel or amend
+    // ends the run since the order it targets may be part of it
+    size_t run_start = 0;
+    while (run_start < commands.size()) {
+        ClientCommand& first = commands[run_start];
+        size_t run_end = run_start + 1;
+        if (!targetsRestingOrder(first.type)) {
+            while (run_end < commands.size() && !targetsRestingOrder(commands[run_end].type) &&
+                   std::strncmp(commands[run_end].instrument, first.instrument, sizeof(first.instrument)) == 0) {
+                ++run_end;
             }
+        }
+        if (run_end - run_start == 1) {
+            handle_command(first);
+        } else {
+            get_instrument_orders(first.instrument).process_batch(commands.subspan(run_start, run_end - run_start));
+        }
+        run_start = run_end;
+    }
+}
 
-            default: {
-                // SyncCerr{} << "Got order: " << static_cast<char>(input.type)
-                //            << " " << input.instrument << " x " << input.count
-                //            << " @ " << input.price << " ID: " << input.order_id
-                //            << std::endl;
-
-                // Remember to take timestamp at the appropriate time, or
-                // compute an appropriate timestamp!
-                // auto output_time = getCurrentTimestamp();
-                // Output::OrderAdded(input.order_id, input.instrument,
-                //                    input.price, input.count,
-                //                    input.type == input_sell, output_time);
-                std::unique_lock<std::mutex> instrument_lock(
-                    instrument_hashmap_write_mut, std::defer_lock);
-                instrument_lock.lock();
-                if (!instrument_hashmap.contains(input.instrument)) {
-                    instrument_hashmap.try_emplace(input.instrument);
-                }
-                InstrumentOrders& instrument_orders =
-                    instrument_hashmap[input.instrument];
-                // std::cout << "Processing command " << input.instrument <<
-                // std::endl;
-                instrument_lock.unlock();
-                instrument_orders.process_command(input);
-                break;
-            }
+void Engine::handle_command(ClientCommand& input) {
+    if (input.type == input_amend) {
+        InstrumentOrders::handle_amend_command(input);
+        return;
+    }
+
+    // Functions for printing output actions in the prescribed format are
+    // provided in the Output class:
+    switch (input.type) {
+        case input_cancel: {
+            // SyncCerr{} << "Got cancel: ID: " << input.order_id << std::endl;
+
+            // Remember to take timestamp at the appropriate time, or
+            // compute an appropriate timestamp!
+            // auto output_time = getCurrentTimestamp();
+            // Output::OrderDeleted(input.order_id, true, output_time);
+
+            ENGINE_TRACE(TraceLevel::Debug, TraceEvent::CancelReceived, input.order_id, 0);
+            InstrumentOrders::handle_cancel_command(input);
+
+            break;
         }
 
-        // Additionally:
+        default: {
+            // SyncCerr{} << "Got order: " << static_cast<char>(input.type)
+            //            << " " << input.instrument << " x " << input.count
+            //            << " @ " << input.price << " ID: " << input.order_id
+            //            << std::endl;
+
+            // Remember to take timestamp at the appropriate time, or
+            // compute an appropriate timestamp!
+            // auto output_time = getCurrentTimestamp();
+            // Output::OrderAdded(input.order_id, input.instrument,
+            //                    input.price, input.count,
+            //                    input.type == input_sell, output_time);
+            InstrumentOrders& instrument_orders =
+                get_instrument_orders(input.instrument);
+            // std::cout << "Processing command " << input.instrument <<
+            // std::endl;
+            instrument_orders.process_command(input);
+            break;
+        }
+    }
+
+    // Additionally:
 
-        // Remember to take timestamp at the appropriate time, or compute
-        // an appropriate timestamp!
-        // intmax_t output_time = getCurrentTimestamp();
+    // Remember to take timestamp at the appropriate time, or compute
+    // an appropriate timestamp!
+    // intmax_t output_time = getCurrentTimestamp();
+
+    // Check the parameter names in `io.hpp`.
+    // Output::OrderExecuted(123, 124, 1, 2000, 10, output_time);
+}
+
+InstrumentOrders& Engine::get_instrument_orders(const char* instrument) {
+    if (matchers.empty()) {
+        return instruments.getOrCreate(instrument, [](InstrumentOrders&) {});
+    }
+    return instruments.getOrCreateWith(instrument, [this](uint32_t instrument_id, const char* name) {
+        uint32_t matcher_idx = place_instrument(name);
+        // made by the matcher that will match it, so that its books are first
+        // touched, and allocated, on that matcher's node
+        std::unique_ptr<InstrumentOrders> instrument_orders;
+        matchers[matcher_idx]->execute(
+            [&] { instrument_orders = std::make_unique<InstrumentOrders>(instrument_id, name); });
+        instrument_orders->matcher_idx.store(matcher_idx, std::memory_order_relaxed);
+        return instrument_orders;
+    });
+}
+
+uint32_t Engine::place_instrument(const char* instrument) {
+    if (config.numa_placement) {
+        std::scoped_lock lock(placement_mut);
+        return placement->assign();
+    }
+    return static_cast<uint32_t>(std::hash<std::string_view>{}(std::string_view(instrument, strnlen(instrument, 8))) %
+                                 matchers.size());
+}
+
+void Engine::with_books(InstrumentOrders& instrument_orders, const std::function<void()>& f) {
+    if (!matchers.empty()) {
+        matchers[acquire_matcher(instrument_orders)]->execute(f);
+        release_matcher(instrument_orders);
+        return;
+    }
+    std::scoped_lock lock(instrument_orders.orderbook(input_buy).queue_mut,
+                          instrument_orders.orderbook(input_sell).queue_mut);
+    f();
+}
+
+// Single-writer mode: every command of an instrument goes through the ring of the
+// matcher owning it, so that matcher sees them in arrival order.
+void Engine::route_command(ClientCommand& input, ClientState& client) {
+    InstrumentOrders* instrument_orders;
+    if (targetsRestingOrder(input.type)) {
+        instrument_orders = InstrumentOrders::find_order(input.order_id);
+        if (instrument_orders == nullptr) {
+            // no instrument to route by; rejected by the matcher of the client's
+            // previous command, so the reject follows that command's output as
+            // it would in locked mode
+            matchers[client.last_matcher]->push(MatcherCommand{input, nullptr});
+            return;
+        }
+    } else {
+        instrument_orders = &get_instrument_orders(input.instrument);
+        // registered here rather than by the matcher, so a cancel that follows
+        // on this connection is routed to the same ring behind the order
+        if (InstrumentOrders::may_rest(input)) {
+            InstrumentOrders::register_order(input.order_id, instrument_orders);
+        }
+    }
+    client.last_matcher = acquire_matcher(*instrument_orders);
+    matchers[client.last_matcher]->push(MatcherCommand{input, instrument_orders});
+    release_matcher(*instrument_orders);
+}
+
+uint32_t Engine::acquire_matcher(InstrumentOrders& instrument_orders) {
+    if (!rebalancing) {
+        return instrument_orders.matcher_idx.load(std::memory_order_relaxed);
+    }
+    // sequentially consistent with move_instrument: either it sees this thread
+    // routing and waits, or this thread sees the instrument moving and waits
+    while (true) {
+        instrument_orders.routing.fetch_add(1);
+        uint32_t matcher_idx = instrument_orders.matcher_idx.load();
+        if (matcher_idx != InstrumentOrders::moving_matcher) {
+            return matcher_idx;
+        }
+        instrument_orders.routing.fetch_sub(1);
+        std::this_thread::yield();
+    }
+}
+
+void Engine::release_matcher(InstrumentOrders& instrument_orders) {
+    if (rebalancing) {
+        instrument_orders.routing.fetch_sub(1, std::memory_order_release);
+    }
+}
+
+void Engine::rebalance_loop() {
+    std::vector<uint64_t> previous_loads;
+    std::unique_lock<std::mutex> lock(rebalance_mut);
+    while (!rebalance_cv.wait_for(lock, config.rebalance_interval, [this] { return rebalance_stopping; })) {
+        lock.unlock();
+        rebalance(previous_loads);
+        lock.lock();
+    }
+}
+
+void Engine::stop_rebalance() {
+    {
+        std::scoped_lock lock(rebalance_mut);
+        rebalance_stopping = true;
+    }
+    rebalance_cv.notify_all();
+    if (rebalance_thread.joinable()) {
+        rebalance_thread.join();
+    }
+}
+
+void Engine::rebalance(std::vector<uint64_t>& previous_loads) {
+    HotPathStatsSnapshot stats = hot_path_stats();
+    size_t num_instruments = stats.instruments.size();
+    std::vector<uint64_t> loads(num_instruments);
+    std::vector<uint32_t> owners(num_instruments);
+    previous_loads.resize(num_instruments, 0);
+    for (uint32_t instrument_id = 0; instrument_id < num_instruments; ++instrument_id) {
+        const auto& counters = stats.instruments[instrument_id];
+        uint64_t total = counters[static_cast<size_t>(HotPathCounter::Orders)] +
+                         counters[static_cast<size_t>(HotPathCounter::CancelsAccepted)] +
+                         counters[static_cast<size_t>(HotPathCounter::CancelsRejected)];
+        loads[instrument_id] = total - previous_loads[instrument_id];
+        previous_loads[instrument_id] = total;
+        owners[instrument_id] = instruments.get(instrument_id).matcher_idx.load(std::memory_order_relaxed);
+    }
+
+    std::optional<InstrumentPlacement::Move> move;
+    {
+        std::scoped_lock lock(placement_mut);
+        move = placement->plan(loads, owners, config.rebalance_imbalance);
+    }
+    if (!move) {
+        return;
+    }
+    move_instrument(instruments.get(move->instrument_id), move->to);
+    std::scoped_lock lock(placement_mut);
+    placement->moved(*move);
+}
 
-        // Check the parameter names in `io.hpp`.
-        // Output::OrderExecuted(123, 124, 1, 2000, 10, output_time);
+// The old matcher finishes every command routed to it before the new one gets any,
+// so commands of a connection are still matched in order. The instrument's memory
+// stays where it was allocated.
+void Engine::move_instrument(InstrumentOrders& instrument_orders, uint32_t to) {
+    uint32_t from = instrument_orders.matcher_idx.exchange(InstrumentOrders::moving_matcher);
+    while (instrument_orders.routing.load() != 0) {
+        std::this_thread::yield();
     }
+    matchers[from]->barrier();
+    instrument_orders.matcher_idx.store(to);
 }
@@ -5,23 +5,193 @@
 #define ENGINE_HPP
 
 #include <chrono>
+#include <condition_variable>
 #include <cstring>
+#include <memory>
 #include <queue>
-#include <unordered_map>
+#include <thread>
+#include <span>
+#include <vector>
 
+#include "client_state.hpp"
+#include "clock.hpp"
+#include "command_capture.hpp"
+#include "event_journal.hpp"
+#include "instrument_directory.hpp"
 #include "instrument_orders.hpp"
 #include "io.hpp"
+#include "io_worker_pool.hpp"
+#include "matcher.hpp"
+#include "persistence.hpp"
+#include "placement.hpp"
+
+struct EngineConfig {
+    enum class Mode {
+        // connection threads match directly, synchronising on the book locks
+        Locked,
+        // connection threads route commands to per-instrument matcher threads
+        SingleWriter,
+    };
+
+    Mode mode = Mode::Locked;
+    size_t num_matchers = 1;
+    // matcher i is pinned to matcher_cpus[i] when given
+    std::vector<int> matcher_cpus;
+    // per matcher, must be a power of two
+    size_t matcher_ring_capacity = 1 << 16;
+    // spread the matchers over NUMA nodes and cores when matcher_cpus is not given,
+    // and give each new instrument to the matcher owning the fewest instead of by hash
+    bool numa_placement = false;
+    // every interval, move a hot instrument off the busiest matcher when its load
+    // exceeds the idlest one's by more than rebalance_imbalance; 0 never moves any
+    std::chrono::milliseconds rebalance_interval{0};
+    double rebalance_imbalance = 0.25;
+
+    // 0 serves every connection on its own detached thread
+    size_t num_io_workers = 0;
+    // I/O worker i is pinned to io_worker_cpus[i] when given
+    std::vector<int> io_worker_cpus;
+
+    // capacity of the instrument directory, which cannot grow
+    size_t max_instruments = 1 << 16;
+
+    // ignored if fixed at build time with ENGINE_TIMESTAMP_SOURCE
+    TimestampSource timestamp_source = fixed_timestamp_source;
+
+    // write output events from a background thread instead of inline
+    bool async_output = false;
+    // async output only, also append binary EventRecords to this file when set
+    std::string journal_path;
+
+    // builds with ENGINE_TRACE_LEVEL > 0 only, dump trace records here on stop
+    std::string trace_path;
+
+    // capacity of the level update stream of each book, 0 to disable it
+    size_t depth_update_capacity = 0;
+
+    // time every acquisition of the matching locks for the lock histograms
+    bool lock_timing = false;
+    // write hot path stats as one JSON line per interval to this file when set
+    std::string stats_path;
+    std::chrono::milliseconds stats_interval{1000};
+
+    // keep the books in a write-ahead log plus snapshots in this directory when
+    // set, and restore them from it on start
+    std::string persistence_dir;
+    std::chrono::milliseconds snapshot_interval{60000};
+    std::chrono::microseconds wal_flush_interval{1000};
+
+    // record every command, in the order connections hand them over, for replay
+    std::string capture_path;
+
+    // ENGINE_MODE=locked|single_writer, ENGINE_MATCHERS=<n>, ENGINE_MATCHER_CPUS=<cpu,cpu,...>,
+    // ENGINE_PLACEMENT=hash|numa, ENGINE_REBALANCE_MS=<ms>, ENGINE_REBALANCE_IMBALANCE=<fraction>,
+    // ENGINE_IO_WORKERS=<n>, ENGINE_IO_WORKER_CPUS=<cpu,cpu,...>,
+    // ENGINE_ASYNC_OUTPUT=0|1, ENGINE_JOURNAL=<path>, ENGINE_TRACE_FILE=<path>,
+    // ENGINE_TIMESTAMP_SOURCE=steady|coarse|tsc, ENGINE_CAPTURE=<path>,
+    // ENGINE_DEPTH_UPDATES=<capacity>, ENGINE_LOCK_TIMING=0|1, ENGINE_STATS_FILE=<path>,
+    // ENGINE_STATS_INTERVAL_MS=<ms>, ENGINE_PERSISTENCE_DIR=<path>, ENGINE_SNAPSHOT_INTERVAL_MS=<ms>,
+    // ENGINE_WAL_FLUSH_US=<us>
+    static EngineConfig fromEnvironment();
+};
+
+struct OrderStateStats {
+    // resting orders tracked by the order books
+    OrderIndexStats books;
+    // order_id -> instrument directory used to route cancels
+    OrderIndexStats directory;
+};
 
 struct Engine {
    private:
-    std::unordered_map<std::string, InstrumentOrders> instrument_hashmap;
-    std::mutex instrument_hashmap_write_mut;
+    EngineConfig config;
+    InstrumentDirectory instruments;
+    // only used in single-writer mode
+    std::vector<std::unique_ptr<Matcher>> matchers;
+    std::mutex placement_mut;
+    std::unique_ptr<InstrumentPlacement> placement;
+    // instruments may move between matchers, routing has to guard against it
+    bool rebalancing = false;
+    std::thread rebalance_thread;
+    std::mutex rebalance_mut;
+    std::condition_variable rebalance_cv;
+    bool rebalance_stopping = false;
+    // only used when config.num_io_workers > 0
+    std::unique_ptr<IoWorkerPool> io_workers;
+    // only used when config.persistence_dir is set
+    std::unique_ptr<Persistence> persistence;
+    // only open when config.capture_path is set
+    CommandCapture capture;
+
+    // periodic stats dump, only running when config.stats_path is set
+    std::thread stats_thread;
+    std::mutex stats_mut;
+    std::condition_variable stats_cv;
+    bool stats_stopping = false;
+
+    // tracks thread-per-connection clients for drain() and stop()
+    std::mutex connections_mut;
+    std::condition_variable connections_cv;
+    size_t active_connections = 0;
+    bool accepting = true;
 
    public:
+    Engine();
+    explicit Engine(EngineConfig config);
+    ~Engine();
+
     void accept(ClientConnection conn);
 
+    // Handles commands as if they were read from the client connection of client,
+    // without a socket; used by in-process drivers such as the benchmarks. Commands
+    // of one client must not be submitted from more than one thread at a time.
+    void submit(std::span<ClientCommand> commands, ClientState& client) { handle_commands(commands, client); }
+
+    // Stops accepting connections, waits for every client to disconnect and for
+    // all their commands to be matched. The engine cannot be restarted.
+    void drain();
+    // Stops accepting connections and, when I/O workers are used, closes the open
+    // ones right away; commands already read are still matched.
+    void stop();
+
+    OrderStateStats order_state_stats();
+    // counters of the matching path, indexed by instrument id; safe while matching
+    HotPathStatsSnapshot hot_path_stats();
+
+    // Top levels of both sides of instrument, read without blocking matching;
+    // false if the instrument never had an order.
+    bool depth_snapshot(const char* instrument, DepthSnapshot& buy, DepthSnapshot& sell);
+    // Appends the level changes of both sides of instrument since the last call,
+    // oldest first per side. Needs depth_update_capacity; at most one consumer
+    // per instrument. A gap in a side's sequences means updates were dropped and
+    // the consumer should resynchronise from depth_snapshot(), whose
+    // dropped_updates counts them.
+    bool poll_level_updates(const char* instrument, std::vector<LevelUpdate>& updates);
+
    private:
     void connection_thread(ClientConnection conn);
+    void connection_ended();
+    void dump_trace();
+    void stats_loop();
+    void stop_stats();
+    void write_stats(FILE* file);
+    void handle_commands(std::span<ClientCommand> commands, ClientState& client);
+    void handle_command(ClientCommand& input);
+    InstrumentOrders& get_instrument_orders(const char* instrument);
+    // runs f with no other thread touching the books of instrument_orders
+    void with_books(InstrumentOrders& instrument_orders, const std::function<void()>& f);
+    void route_command(ClientCommand& input, ClientState& client);
+
+    // single-writer mode: the matcher owning instrument_orders, which cannot move to
+    // another one until the matching release_matcher()
+    uint32_t acquire_matcher(InstrumentOrders& instrument_orders);
+    void release_matcher(InstrumentOrders& instrument_orders);
+    uint32_t place_instrument(const char* instrument);
+    void rebalance_loop();
+    void stop_rebalance();
+    // moves one instrument if the load since the previous call is uneven enough
+    void rebalance(std::vector<uint64_t>& previous_loads);
+    void move_instrument(InstrumentOrders& instrument_orders, uint32_t to);
 };
 
 #endif
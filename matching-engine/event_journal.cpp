@@ -0,0 +1,404 @@
+#include "event_journal.hpp"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "spsc_ring.hpp"
+
+namespace {
+
+// Numbered when emitted. An event that causally follows another, e.g. the
+// execution of a resting order after its add, is emitted after that one returned
+// and so always gets a higher number, whatever the timestamps say.
+struct SequencedEvent {
+    uint64_t sequence;
+    EventRecord record;
+};
+
+struct ProducerRing {
+    SpscRing<SequencedEvent> ring;
+    // set once the producing thread exited, the writer frees the ring after draining it
+    std::atomic<bool> retired{false};
+
+    explicit ProducerRing(size_t capacity) : ring(capacity) {}
+};
+
+// Append-only file of raw EventRecords, grown and remapped a chunk at a time.
+class MappedJournal {
+    static constexpr size_t chunk_size = 64 << 20;
+
+    int fd = -1;
+    char* base = nullptr;
+    size_t mapped_size = 0;
+    size_t used_size = 0;
+
+   public:
+    bool open(const std::string& path) {
+        fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        return fd >= 0 && grow();
+    }
+
+    bool isOpen() const { return fd >= 0; }
+
+    void append(const EventRecord* records, size_t num_records) {
+        size_t bytes = num_records * sizeof(EventRecord);
+        while (used_size + bytes > mapped_size) {
+            if (!grow()) {
+                return;
+            }
+        }
+        std::memcpy(base + used_size, records, bytes);
+        used_size += bytes;
+    }
+
+    void close() {
+        if (fd < 0) {
+            return;
+        }
+        munmap(base, mapped_size);
+        [[maybe_unused]] int truncated = ftruncate(fd, used_size);
+        ::close(fd);
+        fd = -1;
+        base = nullptr;
+        mapped_size = used_size = 0;
+    }
+
+   private:
+    bool grow() {
+        size_t new_size = mapped_size + chunk_size;
+        if (ftruncate(fd, new_size) != 0) {
+            SyncCerr() << "Failed to grow event journal" << std::endl;
+            return false;
+        }
+        if (base != nullptr) {
+            munmap(base, mapped_size);
+        }
+        void* mapped = mmap(nullptr, new_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (mapped == MAP_FAILED) {
+            SyncCerr() << "Failed to map event journal" << std::endl;
+            base = nullptr;
+            mapped_size = 0;
+            return false;
+        }
+        base = static_cast<char*>(mapped);
+        mapped_size = new_size;
+        return true;
+    }
+};
+
+struct JournalState {
+    std::atomic<bool> async{false};
+    std::atomic<EventJournal::EventHandler> handler{nullptr};
+    void* handler_context = nullptr;
+    std::atomic<bool> running{false};
+    EventJournal::Options options;
+    // number of the next emitted event
+    std::atomic<uint64_t> next_sequence{0};
+
+    std::mutex rings_mut;
+    std::vector<std::shared_ptr<ProducerRing>> rings;
+
+    std::thread writer;
+    MappedJournal journal;
+};
+
+JournalState state;
+
+struct ThreadRing {
+    std::shared_ptr<ProducerRing> ring;
+
+    ~ThreadRing() {
+        if (ring) {
+            ring->retired.store(true, std::memory_order_release);
+        }
+    }
+};
+
+thread_local ThreadRing thread_ring;
+
+struct DeferredEvents {
+    // defer() calls not yet matched by flushDeferred(), only the outermost flushes
+    unsigned depth = 0;
+    std::vector<EventRecord> records;
+};
+
+thread_local DeferredEvents deferred_events;
+
+template <typename T>
+void appendNumber(std::string& out, T value) {
+    char digits[24];
+    auto [end, error] = std::to_chars(digits, digits + sizeof(digits), value);
+    out.append(digits, end);
+}
+
+// must produce exactly what Output would print for the same event
+void formatEvent(std::string& out, const EventRecord& record) {
+    switch (record.type) {
+        case EventType::OrderAdded:
+            out += record.flag ? "S " : "B ";
+            appendNumber(out, record.order_id);
+            out += ' ';
+            out += record.instrument;
+            out += ' ';
+            appendNumber(out, record.price);
+            out += ' ';
+            appendNumber(out, record.count);
+            break;
+        case EventType::OrderExecuted:
+            out += "E ";
+            appendNumber(out, record.order_id);
+            out += ' ';
+            appendNumber(out, record.active_order_id);
+            out += ' ';
+            appendNumber(out, record.execution_id);
+            out += ' ';
+            appendNumber(out, record.price);
+            out += ' ';
+            appendNumber(out, record.count);
+            break;
+        case EventType::OrderDeleted:
+            out += "X ";
+            appendNumber(out, record.order_id);
+            out += record.flag ? " A" : " R";
+            break;
+    }
+    out += ' ';
+    appendNumber(out, record.timestamp);
+    out += '\n';
+}
+
+void writerLoop() {
+    static constexpr size_t max_records_per_ring = 4096;
+
+    std::vector<std::shared_ptr<ProducerRing>> rings;
+    // drained events still waiting for one with a lower number, min-heap on sequence
+    std::vector<SequencedEvent> pending;
+    auto later = [](const SequencedEvent& a, const SequencedEvent& b) { return a.sequence > b.sequence; };
+    uint64_t next_to_write = 0;
+    std::vector<EventRecord> batch;
+    std::string formatted;
+
+    while (true) {
+        // read before draining, so everything emitted before stop() is drained first
+        bool stopping = !state.running.load(std::memory_order_acquire);
+        {
+            std::scoped_lock lock(state.rings_mut);
+            std::erase_if(state.rings, [](const std::shared_ptr<ProducerRing>& ring) {
+                return ring->retired.load(std::memory_order_acquire) && ring->ring.empty();
+            });
+            rings = state.rings;
+        }
+
+        SequencedEvent event;
+        for (auto& ring : rings) {
+            for (size_t i = 0; i < max_records_per_ring && ring->ring.tryPop(event); ++i) {
+                pending.push_back(event);
+                std::push_heap(pending.begin(), pending.end(), later);
+            }
+        }
+
+        // Only a gapless run of numbers can be written: a missing number belongs to
+        // an event that was numbered but not pushed yet, or that sits in a ring
+        // drained before it landed, and may precede the ones after it.
+        batch.clear();
+        while (!pending.empty() && pending.front().sequence == next_to_write) {
+            batch.push_back(pending.front().record);
+            std::pop_heap(pending.begin(), pending.end(), later);
+            pending.pop_back();
+            ++next_to_write;
+        }
+
+        if (batch.empty()) {
+            if (stopping && pending.empty()) {
+                return;
+            }
+            std::this_thread::sleep_for(std::chrono::microseconds(50));
+            continue;
+        }
+
+        formatted.clear();
+        for (const EventRecord& record : batch) {
+            formatEvent(formatted, record);
+        }
+        std::cout.write(formatted.data(), formatted.size());
+        std::cout.flush();
+
+        if (state.journal.isOpen()) {
+            state.journal.append(batch.data(), batch.size());
+        }
+    }
+}
+
+}  // namespace
+
+void EventJournal::start(const Options& options) {
+    if (state.async.load()) {
+        return;
+    }
+    state.options = options;
+    state.next_sequence.store(0);
+    if (!options.journal_path.empty() && !state.journal.open(options.journal_path)) {
+        SyncCerr() << "Failed to open event journal " << options.journal_path << std::endl;
+    }
+    state.running.store(true);
+    state.writer = std::thread(writerLoop);
+    state.async.store(true);
+}
+
+void EventJournal::stop() {
+    if (!state.async.exchange(false)) {
+        return;
+    }
+    state.running.store(false, std::memory_order_release);
+    state.writer.join();
+    state.journal.close();
+}
+
+void EventJournal::redirect(EventHandler handler, void* context) {
+    state.handler_context = context;
+    state.handler.store(handler);
+}
+
+void EventJournal::format(std::string& out, const EventRecord& record) {
+    formatEvent(out, record);
+}
+
+void EventJournal::defer() {
+    ++deferred_events.depth;
+}
+
+void EventJournal::flushDeferred() {
+    DeferredEvents& deferred = deferred_events;
+    if (--deferred.depth > 0) {
+        return;
+    }
+    for (const EventRecord& record : deferred.records) {
+        publish(record);
+    }
+    deferred.records.clear();
+}
+
+bool EventJournal::deferIfRequested(const EventRecord& record) {
+    DeferredEvents& deferred = deferred_events;
+    if (deferred.depth == 0) {
+        return false;
+    }
+    deferred.records.push_back(record);
+    return true;
+}
+
+// same routing as the OrderX functions, for an event that is already a record
+void EventJournal::publish(const EventRecord& record) {
+    bool async = state.async.load(std::memory_order_relaxed);
+    EventHandler handler = state.handler.load(std::memory_order_relaxed);
+    if (async || handler != nullptr) {
+        dispatch(record, async, handler);
+        return;
+    }
+    switch (record.type) {
+        case EventType::OrderAdded:
+            Output::OrderAdded(record.order_id, record.instrument, record.price, record.count, record.flag, record.timestamp);
+            break;
+        case EventType::OrderExecuted:
+            Output::OrderExecuted(record.order_id, record.active_order_id, record.execution_id, record.price,
+                                  record.count, record.timestamp);
+            break;
+        case EventType::OrderDeleted:
+            Output::OrderDeleted(record.order_id, record.flag, record.timestamp);
+            break;
+    }
+}
+
+void EventJournal::dispatch(const EventRecord& record, bool async, EventHandler handler) {
+    if (async) {
+        emit(record);
+    } else {
+        handler(record, state.handler_context);
+    }
+}
+
+void EventJournal::emit(const EventRecord& record) {
+    ThreadRing& local = thread_ring;
+    if (!local.ring) {
+        local.ring = std::make_shared<ProducerRing>(state.options.ring_capacity);
+        std::scoped_lock lock(state.rings_mut);
+        state.rings.push_back(local.ring);
+    }
+    // relaxed is enough: a causally later event's increment happens after this one
+    SequencedEvent event{state.next_sequence.fetch_add(1, std::memory_order_relaxed), record};
+    while (!local.ring->ring.tryPush(event)) {
+        std::this_thread::yield();
+    }
+}
+
+void EventJournal::OrderAdded(uint32_t id, const char* symbol, uint32_t price,
+                              uint32_t count, bool is_sell_side,
+                              intmax_t output_timestamp) {
+    bool async = state.async.load(std::memory_order_relaxed);
+    EventHandler handler = state.handler.load(std::memory_order_relaxed);
+    if (!async && handler == nullptr && deferred_events.depth == 0) {
+        Output::OrderAdded(id, symbol, price, count, is_sell_side, output_timestamp);
+        return;
+    }
+    EventRecord record{};
+    record.type = EventType::OrderAdded;
+    record.timestamp = output_timestamp;
+    record.order_id = id;
+    record.price = price;
+    record.count = count;
+    record.flag = is_sell_side;
+    std::strncpy(record.instrument, symbol, sizeof(record.instrument) - 1);
+    if (!deferIfRequested(record)) {
+        dispatch(record, async, handler);
+    }
+}
+
+void EventJournal::OrderExecuted(uint32_t resting_id, uint32_t new_id,
+                                 uint32_t execution_id, uint32_t price,
+                                 uint32_t count, intmax_t output_timestamp) {
+    bool async = state.async.load(std::memory_order_relaxed);
+    EventHandler handler = state.handler.load(std::memory_order_relaxed);
+    if (!async && handler == nullptr && deferred_events.depth == 0) {
+        Output::OrderExecuted(resting_id, new_id, execution_id, price, count, output_timestamp);
+        return;
+    }
+    EventRecord record{};
+    record.type = EventType::OrderExecuted;
+    record.timestamp = output_timestamp;
+    record.order_id = resting_id;
+    record.active_order_id = new_id;
+    record.execution_id = execution_id;
+    record.price = price;
+    record.count = count;
+    if (!deferIfRequested(record)) {
+        dispatch(record, async, handler);
+    }
+}
+
+void EventJournal::OrderDeleted(uint32_t id, bool cancel_accepted,
+                                intmax_t output_timestamp) {
+    bool async = state.async.load(std::memory_order_relaxed);
+    EventHandler handler = state.handler.load(std::memory_order_relaxed);
+    if (!async && handler == nullptr && deferred_events.depth == 0) {
+        Output::OrderDeleted(id, cancel_accepted, output_timestamp);
+        return;
+    }
+    EventRecord record{};
+    record.type = EventType::OrderDeleted;
+    record.timestamp = output_timestamp;
+    record.order_id = id;
+    record.flag = cancel_accepted;
+    if (!deferIfRequested(record)) {
+        dispatch(record, async, handler);
+    }
+}
@@ -0,0 +1,84 @@
+#ifndef EVENT_JOURNAL_HPP
+#define EVENT_JOURNAL_HPP
+
+#include <cstdint>
+#include <string>
+
+#include "io.hpp"
+
+enum class EventType : uint8_t {
+    OrderAdded,
+    OrderExecuted,
+    OrderDeleted,
+};
+
+// Fixed-size binary form of one output event, also the record format of the
+// binary journal file.
+struct EventRecord {
+    intmax_t timestamp;
+    // OrderExecuted: resting order id, otherwise the order id
+    uint32_t order_id;
+    // OrderExecuted only: id of the active order
+    uint32_t active_order_id;
+    uint32_t execution_id;
+    uint32_t price;
+    uint32_t count;
+    EventType type;
+    // OrderAdded: is_sell_side, OrderDeleted: cancel_accepted
+    bool flag;
+    char instrument[9];
+};
+
+// Drop-in replacement for Output. In synchronous mode (the default) every call
+// goes straight to Output. Once start()ed, calls only copy the event into a ring
+// owned by the calling thread, numbered from one counter shared by all threads; a
+// background writer drains all rings, merges them back into that order, which
+// respects causality where timestamps may not, formats each batch as Output does
+// and flushes it in one write, optionally also appending the raw records to a
+// memory-mapped journal file.
+class EventJournal {
+   public:
+    struct Options {
+        // empty for no binary journal
+        std::string journal_path;
+        // per producing thread, must be a power of two
+        size_t ring_capacity = 1 << 14;
+    };
+
+    using EventHandler = void (*)(const EventRecord& record, void* context);
+
+    static void start(const Options& options);
+    // writes out every event emitted so far and joins the writer
+    static void stop();
+
+    static void OrderAdded(uint32_t id, const char* symbol, uint32_t price,
+                           uint32_t count, bool is_sell_side,
+                           intmax_t output_timestamp);
+    static void OrderExecuted(uint32_t resting_id, uint32_t new_id,
+                              uint32_t execution_id, uint32_t price,
+                              uint32_t count, intmax_t output_timestamp);
+    static void OrderDeleted(uint32_t id, bool cancel_accepted,
+                             intmax_t output_timestamp);
+
+    // Synchronous mode only: hands every event to handler instead of Output, e.g.
+    // for benchmarks and replay. nullptr restores Output. Not meant to be changed
+    // while events are being emitted.
+    static void redirect(EventHandler handler, void* context);
+
+    // Events emitted by the calling thread after defer() are held back until
+    // flushDeferred(), which emits them in order in one go, e.g. the events of a
+    // batch of commands. Calls nest, only the outermost flushDeferred() emits.
+    static void defer();
+    static void flushDeferred();
+
+    // appends the event as one line in Output's format
+    static void format(std::string& out, const EventRecord& record);
+
+   private:
+    static void dispatch(const EventRecord& record, bool async, EventHandler handler);
+    static void emit(const EventRecord& record);
+    static bool deferIfRequested(const EventRecord& record);
+    static void publish(const EventRecord& record);
+};
+
+#endif
@@ -0,0 +1,203 @@
+#include "hot_path_stats.hpp"
+
+#include <bit>
+#include <memory>
+
+namespace {
+
+struct alignas(64) CounterBlock {
+    std::array<std::atomic<uint64_t>, num_hot_path_counters> values{};
+};
+
+static_assert(sizeof(CounterBlock) == 64);
+
+struct LockHistograms {
+    std::array<std::atomic<uint64_t>, DurationHistogram::num_buckets> wait{};
+    std::array<std::atomic<uint64_t>, DurationHistogram::num_buckets> hold{};
+};
+
+// only written by its thread, read by snapshot()
+struct ThreadStats {
+    static constexpr uint32_t chunk_bits = 6;
+    static constexpr uint32_t chunk_size = 1 << chunk_bits;
+    // instruments with higher ids are counted in overflow
+    static constexpr uint32_t max_chunks = 1024;
+
+    // blocks of 64 instruments, allocated on first use and never moved
+    std::array<std::atomic<CounterBlock*>, max_chunks> chunks{};
+    CounterBlock overflow;
+    CounterBlock unrouted;
+    std::array<LockHistograms, num_lock_kinds> locks;
+
+    ~ThreadStats() {
+        for (auto& chunk : chunks) {
+            delete[] chunk.load(std::memory_order_relaxed);
+        }
+    }
+
+    CounterBlock& blockFor(uint32_t instrument_id) {
+        uint32_t chunk_idx = instrument_id >> chunk_bits;
+        if (chunk_idx >= max_chunks) {
+            return overflow;
+        }
+        CounterBlock* chunk = chunks[chunk_idx].load(std::memory_order_relaxed);
+        if (chunk == nullptr) {
+            chunk = new CounterBlock[chunk_size];
+            chunks[chunk_idx].store(chunk, std::memory_order_release);
+        }
+        return chunk[instrument_id & (chunk_size - 1)];
+    }
+};
+
+// single writer, so no read-modify-write instruction is needed
+inline void bump(std::atomic<uint64_t>& value, uint64_t n) {
+    value.store(value.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+}
+
+size_t bucketFor(int64_t ns) {
+    if (ns <= 1) {
+        return 0;
+    }
+    return std::min<size_t>(std::bit_width(static_cast<uint64_t>(ns)) - 1, DurationHistogram::num_buckets - 1);
+}
+
+struct Registry {
+    std::mutex mut;
+    std::vector<ThreadStats*> threads;
+    // counts of threads that exited
+    HotPathStatsSnapshot retired;
+
+    void add(const ThreadStats& stats, HotPathStatsSnapshot& into) {
+        for (uint32_t chunk_idx = 0; chunk_idx < ThreadStats::max_chunks; ++chunk_idx) {
+            CounterBlock* chunk = stats.chunks[chunk_idx].load(std::memory_order_acquire);
+            if (chunk == nullptr) {
+                continue;
+            }
+            size_t end = size_t(chunk_idx + 1) << ThreadStats::chunk_bits;
+            if (into.instruments.size() < end) {
+                into.instruments.resize(end);
+            }
+            for (uint32_t i = 0; i < ThreadStats::chunk_size; ++i) {
+                auto& counters = into.instruments[(size_t(chunk_idx) << ThreadStats::chunk_bits) + i];
+                for (size_t c = 0; c < num_hot_path_counters; ++c) {
+                    uint64_t value = chunk[i].values[c].load(std::memory_order_relaxed);
+                    counters[c] += value;
+                    into.totals[c] += value;
+                }
+            }
+        }
+        for (size_t c = 0; c < num_hot_path_counters; ++c) {
+            into.totals[c] += stats.overflow.values[c].load(std::memory_order_relaxed) +
+                              stats.unrouted.values[c].load(std::memory_order_relaxed);
+        }
+        for (size_t kind = 0; kind < num_lock_kinds; ++kind) {
+            for (size_t b = 0; b < DurationHistogram::num_buckets; ++b) {
+                into.locks[kind].wait.buckets[b] += stats.locks[kind].wait[b].load(std::memory_order_relaxed);
+                into.locks[kind].hold.buckets[b] += stats.locks[kind].hold[b].load(std::memory_order_relaxed);
+            }
+        }
+    }
+};
+
+Registry& registry() {
+    // never destroyed, threads may exit during static destruction
+    static Registry* instance = new Registry();
+    return *instance;
+}
+
+struct ThreadSlot {
+    std::unique_ptr<ThreadStats> stats;
+
+    ThreadStats& get() {
+        if (!stats) {
+            stats = std::make_unique<ThreadStats>();
+            Registry& reg = registry();
+            std::scoped_lock lock(reg.mut);
+            reg.threads.push_back(stats.get());
+        }
+        return *stats;
+    }
+
+    ~ThreadSlot() {
+        if (!stats) {
+            return;
+        }
+        Registry& reg = registry();
+        std::scoped_lock lock(reg.mut);
+        reg.add(*stats, reg.retired);
+        std::erase(reg.threads, stats.get());
+    }
+};
+
+thread_local ThreadSlot thread_slot;
+
+}  // namespace
+
+const char* counterName(HotPathCounter counter) {
+    switch (counter) {
+        case HotPathCounter::Orders: return "orders";
+        case HotPathCounter::Rested: return "rested";
+        case HotPathCounter::Fills: return "fills";
+        case HotPathCounter::Sweeps: return "sweeps";
+        case HotPathCounter::CancelsAccepted: return "cancels_accepted";
+        case HotPathCounter::CancelsRejected: return "cancels_rejected";
+        case HotPathCounter::AddRetries: return "add_retries";
+        case HotPathCounter::Batches: return "batches";
+    }
+    return "unknown";
+}
+
+const char* lockKindName(LockKind kind) {
+    switch (kind) {
+        case LockKind::BookQueue: return "book_queue";
+        case LockKind::OrderDirectory: return "order_directory";
+        case LockKind::InstrumentDirectoryWrite: return "instrument_directory_write";
+    }
+    return "unknown";
+}
+
+uint64_t DurationHistogram::count() const {
+    uint64_t total = 0;
+    for (uint64_t bucket : buckets) {
+        total += bucket;
+    }
+    return total;
+}
+
+uint64_t DurationHistogram::quantile(double q) const {
+    uint64_t total = count();
+    uint64_t seen = 0;
+    for (size_t i = 0; i < num_buckets; ++i) {
+        seen += buckets[i];
+        if (total > 0 && seen >= q * total) {
+            return uint64_t{2} << i;
+        }
+    }
+    return 0;
+}
+
+void HotPathStats::count(uint32_t instrument_id, HotPathCounter counter, uint64_t n) {
+    bump(thread_slot.get().blockFor(instrument_id).values[static_cast<size_t>(counter)], n);
+}
+
+void HotPathStats::countUnrouted(HotPathCounter counter, uint64_t n) {
+    bump(thread_slot.get().unrouted.values[static_cast<size_t>(counter)], n);
+}
+
+void HotPathStats::recordLockWait(LockKind kind, int64_t ns) {
+    bump(thread_slot.get().locks[static_cast<size_t>(kind)].wait[bucketFor(ns)], 1);
+}
+
+void HotPathStats::recordLockHold(LockKind kind, int64_t ns) {
+    bump(thread_slot.get().locks[static_cast<size_t>(kind)].hold[bucketFor(ns)], 1);
+}
+
+HotPathStatsSnapshot HotPathStats::snapshot() {
+    Registry& reg = registry();
+    std::scoped_lock lock(reg.mut);
+    HotPathStatsSnapshot snapshot = reg.retired;
+    for (ThreadStats* stats : reg.threads) {
+        reg.add(*stats, snapshot);
+    }
+    return snapshot;
+}
@@ -0,0 +1,137 @@
+#ifndef HOT_PATH_STATS_HPP
+#define HOT_PATH_STATS_HPP
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+#include "clock.hpp"
+
+// What the matching path counts, per instrument.
+enum class HotPathCounter : uint8_t {
+    // buy/sell commands matched
+    Orders,
+    // orders added to a book
+    Rested,
+    // executions against resting orders
+    Fills,
+    // OrderBook::sweep calls, each one critical section producing >= 1 fill
+    Sweeps,
+    CancelsAccepted,
+    CancelsRejected,
+    // lockQueuesAndAddOrder found a crossing order that arrived while unlocked
+    AddRetries,
+    // InstrumentOrders::process_batch calls
+    Batches,
+};
+
+inline constexpr size_t num_hot_path_counters = 8;
+
+// snake_case name, for dumps
+const char* counterName(HotPathCounter counter);
+
+enum class LockKind : uint8_t {
+    // OrderBook::queue_mut
+    BookQueue,
+    // OrderDirectory stripe mutexes
+    OrderDirectory,
+    // InstrumentDirectory::write_mut
+    InstrumentDirectoryWrite,
+};
+
+inline constexpr size_t num_lock_kinds = 3;
+
+const char* lockKindName(LockKind kind);
+
+// Log2 histogram: bucket i counts durations in [2^i, 2^(i+1)) ns, bucket 0 also 0 ns.
+struct DurationHistogram {
+    static constexpr size_t num_buckets = 32;
+    std::array<uint64_t, num_buckets> buckets{};
+
+    uint64_t count() const;
+    // upper bound of the bucket holding the given quantile, in ns
+    uint64_t quantile(double q) const;
+};
+
+struct LockStats {
+    DurationHistogram wait;
+    DurationHistogram hold;
+};
+
+struct HotPathStatsSnapshot {
+    using Counters = std::array<uint64_t, num_hot_path_counters>;
+
+    // indexed by instrument id
+    std::vector<Counters> instruments;
+    // all instruments, plus cancels that matched no instrument
+    Counters totals{};
+    std::array<LockStats, num_lock_kinds> locks;
+};
+
+// Always-on counters of the matching path, and optional lock timing.
+//
+// Every thread counts into its own blocks, one 64-byte line per instrument it
+// touched, so counting is a plain add with no sharing between threads; blocks
+// are only summed when a snapshot is taken. Counts of exited threads are folded
+// into a global total. Lock wait/hold histograms additionally read the clock
+// around every acquisition, so they are off unless enabled.
+class HotPathStats {
+   public:
+    static void count(uint32_t instrument_id, HotPathCounter counter, uint64_t n = 1);
+    // for events that belong to no instrument, such as a cancel of an unknown order
+    static void countUnrouted(HotPathCounter counter, uint64_t n = 1);
+
+    // not meant to be changed while locks are held
+    static void enableLockTiming(bool enabled) { lock_timing.store(enabled, std::memory_order_relaxed); }
+    static bool lockTimingEnabled() { return lock_timing.load(std::memory_order_relaxed); }
+    static void recordLockWait(LockKind kind, int64_t ns);
+    static void recordLockHold(LockKind kind, int64_t ns);
+
+    // relaxed reads of live counters: each value is exact, but values read from
+    // different threads are not from one instant
+    static HotPathStatsSnapshot snapshot();
+
+   private:
+    static inline std::atomic<bool> lock_timing{false};
+};
+
+// std::mutex that feeds the lock histograms of Kind when lock timing is enabled.
+// Meets Lockable, so it works with scoped_lock, unique_lock and std::lock.
+template <LockKind Kind>
+class InstrumentedMutex {
+    std::mutex mut;
+    // set by the owner once acquired, 0 if timing was off when it was acquired
+    int64_t locked_at = 0;
+
+   public:
+    void lock() {
+        if (!HotPathStats::lockTimingEnabled()) {
+            mut.lock();
+            locked_at = 0;
+            return;
+        }
+        int64_t start = Clock::now();
+        mut.lock();
+        locked_at = Clock::now();
+        HotPathStats::recordLockWait(Kind, locked_at - start);
+    }
+
+    bool try_lock() {
+        if (!mut.try_lock()) {
+            return false;
+        }
+        locked_at = HotPathStats::lockTimingEnabled() ? Clock::now() : 0;
+        return true;
+    }
+
+    void unlock() {
+        if (locked_at != 0) {
+            HotPathStats::recordLockHold(Kind, Clock::now() - locked_at);
+        }
+        mut.unlock();
+    }
+};
+
+#endif
@@ -0,0 +1,28 @@
+#include "instrument_directory.hpp"
+
+#include <bit>
+#include <cstdlib>
+
+InstrumentDirectory::InstrumentDirectory(size_t max_instruments)
+    : max_instruments(max_instruments),
+      // at most half full, so probe runs stay short and always end at an empty slot
+      mask(std::bit_ceil(max_instruments * 2) - 1),
+      slots(new Slot[mask + 1]),
+      instruments(new std::unique_ptr<InstrumentOrders>[max_instruments]) {}
+
+void InstrumentDirectory::publish(uint64_t key, std::unique_ptr<InstrumentOrders> instrument_orders) {
+    uint32_t instrument_id = num_instruments.load(std::memory_order_relaxed);
+    if (instrument_id >= max_instruments) {
+        SyncCerr() << "More than " << max_instruments << " instruments, raise EngineConfig::max_instruments" << std::endl;
+        std::abort();
+    }
+    instruments[instrument_id] = std::move(instrument_orders);
+    num_instruments.store(instrument_id + 1, std::memory_order_release);
+
+    size_t i = home(key);
+    while (slots[i].key.load(std::memory_order_relaxed) != 0) {
+        i = (i + 1) & mask;
+    }
+    slots[i].instrument_id = instrument_id;
+    slots[i].key.store(key, std::memory_order_release);
+}
@@ -0,0 +1,104 @@
+#ifndef INSTRUMENT_DIRECTORY_HPP
+#define INSTRUMENT_DIRECTORY_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
+
+#include "hot_path_stats.hpp"
+#include "instrument_orders.hpp"
+#include "io.hpp"
+
+// Interns instrument names to dense ids and owns the InstrumentOrders of each.
+//
+// Read-mostly: an instrument is created once, on its first order, and looked up
+// on every order after that. Lookups take no lock and allocate nothing: the name
+// (at most 8 characters) is packed into a uint64_t key and searched for in an
+// open-addressing table whose slots are published with a release store of the
+// key after everything else is written. Creation is serialised by write_mut.
+// Entries are never removed or moved, which is what keeps readers lock-free, so
+// the table has a fixed capacity.
+class InstrumentDirectory {
+    struct Slot {
+        std::atomic<uint64_t> key{0};
+        uint32_t instrument_id = 0;
+    };
+
+    size_t max_instruments;
+    size_t mask;
+    std::unique_ptr<Slot[]> slots;
+    // indexed by instrument id, entries below num_instruments are immutable
+    std::unique_ptr<std::unique_ptr<InstrumentOrders>[]> instruments;
+    std::atomic<uint32_t> num_instruments{0};
+
+    InstrumentedMutex<LockKind::InstrumentDirectoryWrite> write_mut;
+
+   public:
+    explicit InstrumentDirectory(size_t max_instruments);
+
+    // init runs before the new instrument becomes visible to other threads
+    template <typename F>
+    InstrumentOrders& getOrCreate(const char* instrument, F init) {
+        return getOrCreateWith(instrument, [&init](uint32_t instrument_id, const char* name) {
+            auto instrument_orders = std::make_unique<InstrumentOrders>(instrument_id, name);
+            init(*instrument_orders);
+            return instrument_orders;
+        });
+    }
+
+    // As getOrCreate, with construct(instrument_id, instrument) making the new
+    // instrument, e.g. on the thread that will match it so that its memory is first
+    // touched on that thread's NUMA node.
+    template <typename C>
+    InstrumentOrders& getOrCreateWith(const char* instrument, C construct) {
+        uint64_t key = packName(instrument);
+        if (InstrumentOrders* instrument_orders = find(key)) {
+            return *instrument_orders;
+        }
+
+        std::scoped_lock lock(write_mut);
+        if (InstrumentOrders* instrument_orders = find(key)) {
+            return *instrument_orders;
+        }
+        uint32_t instrument_id = num_instruments.load(std::memory_order_relaxed);
+        publish(key, construct(instrument_id, instrument));
+        return *instruments[instrument_id];
+    }
+
+    // nullptr if instrument was never created
+    InstrumentOrders* find(const char* instrument) { return find(packName(instrument)); }
+
+    uint32_t size() const { return num_instruments.load(std::memory_order_acquire); }
+
+    // instrument_id must be below size()
+    InstrumentOrders& get(uint32_t instrument_id) { return *instruments[instrument_id]; }
+
+   private:
+    static uint64_t packName(const char* instrument) {
+        uint64_t key = 0;
+        std::memcpy(&key, instrument, strnlen(instrument, sizeof(key)));
+        // 0 marks an empty slot
+        return key == 0 ? ~uint64_t{0} : key;
+    }
+
+    size_t home(uint64_t key) const { return static_cast<size_t>((key * 0x9E3779B97F4A7C15ull) >> 32) & mask; }
+
+    InstrumentOrders* find(uint64_t key) {
+        for (size_t i = home(key);; i = (i + 1) & mask) {
+            uint64_t slot_key = slots[i].key.load(std::memory_order_acquire);
+            if (slot_key == key) {
+                return instruments[slots[i].instrument_id].get();
+            }
+            if (slot_key == 0) {
+                return nullptr;
+            }
+        }
+    }
+
+    // write_mut must be held
+    void publish(uint64_t key, std::unique_ptr<InstrumentOrders> instrument_orders);
+};
+
+#endif
@@ -2,25 +2,117 @@
 
 #include "engine.hpp"
 #include "io.hpp"
+#include "trace.hpp"
+
+OrderDirectory InstrumentOrders::order_directory;
+
+InstrumentOrders::InstrumentOrders(uint32_t instrument_id, const char* instrument)
+    : instrument_id(instrument_id),
+      buy_orderbook(input_buy, instrument_id, this->instrument, next_sequence),
+      sell_orderbook(input_sell, instrument_id, this->instrument, next_sequence) {
+    strncpy(this->instrument, instrument, sizeof(this->instrument) - 1);
+    this->instrument[sizeof(this->instrument) - 1] = '\0';
+}
 
 void InstrumentOrders::process_command(ClientCommand& command) {
     // std::cout << "Processing command" << std::endl;
     if (command.type == input_buy || command.type == input_sell) {
         handle_buy_sell_command(command);
+    } else if (isImmediateOrder(command.type)) {
+        match_immediate(command);
     } else {
         handle_cancel_command(command);
     }
 }
 
 void InstrumentOrders::handle_buy_sell_command(ClientCommand& command) {
+    // registered before the order can rest, so a cancel that races with the
+    // OrderAdded output is still routed here
+    if (may_rest(command)) {
+        register_order(command.order_id, this);
+    }
     // if (!add_order_if_opp_order_book_empty(command)) {
     // std::cout << "Calling match" << std::endl;
         match(command);
     // }
 }
 
+void InstrumentOrders::process_batch(std::span<ClientCommand> commands) {
+    for (ClientCommand& command : commands) {
+        if (may_rest(command)) {
+            register_order(command.order_id, this);
+        }
+    }
+    // with both books locked for the whole run the unlocked match applies as is
+    std::scoped_lock lock(buy_orderbook.queue_mut, sell_orderbook.queue_mut);
+    HotPathStats::count(instrument_id, HotPathCounter::Batches);
+    EventJournal::defer();
+    for (ClientCommand& command : commands) {
+        if (isImmediateOrder(command.type)) {
+            match_immediate_unlocked(command);
+        } else {
+            match_unlocked(command);
+        }
+    }
+    // still under the locks, like OrderAdded on the single-command path, so no other
+    // thread can output an event about these orders ahead of the run's own events
+    EventJournal::flushDeferred();
+}
+
+void InstrumentOrders::register_order(uint32_t order_id, InstrumentOrders* instrument_orders) {
+    order_directory.insert(order_id, instrument_orders);
+}
+
+InstrumentOrders* InstrumentOrders::find_order(uint32_t order_id) {
+    return order_directory.find(order_id);
+}
+
 void InstrumentOrders::handle_cancel_command(ClientCommand& command) {
-    OrderBook::lockHashmapAndDeleteOrder(command.order_id);
+    InstrumentOrders* instrument_orders = find_order(command.order_id);
+    if (instrument_orders == nullptr) {
+        reject_unknown_order(command.order_id);
+        return;
+    }
+    instrument_orders->cancel(command.order_id);
+}
+
+void InstrumentOrders::handle_amend_command(ClientCommand& command) {
+    InstrumentOrders* instrument_orders = find_order(command.order_id);
+    if (instrument_orders == nullptr) {
+        reject_unknown_order(command.order_id);
+        return;
+    }
+    instrument_orders->amend(command);
+}
+
+void InstrumentOrders::reject_unknown_order(uint32_t order_id) {
+    HotPathStats::countUnrouted(HotPathCounter::CancelsRejected);
+    EventJournal::OrderDeleted(order_id, false, getCurrentTimestamp());
+}
+
+void InstrumentOrders::cancel(uint32_t order_id) {
+    std::unique_lock buy_queue_lock(buy_orderbook.queue_mut, std::defer_lock);
+    std::unique_lock sell_queue_lock(sell_orderbook.queue_mut, std::defer_lock);
+    std::lock(buy_queue_lock, sell_queue_lock);
+    // the order is unlinked right away, no stale entry is left in the book
+    bool cancelled = buy_orderbook.removeOrder(order_id) || sell_orderbook.removeOrder(order_id);
+    int64_t timestamp = getCurrentTimestamp();
+    buy_queue_lock.unlock();
+    sell_queue_lock.unlock();
+    if (cancelled) {
+        order_directory.erase(order_id);
+    }
+    count_cancel(cancelled);
+    EventJournal::OrderDeleted(order_id, cancelled, timestamp);
+}
+
+// the whole amend, including any fills of a moved order, is one critical section
+void InstrumentOrders::amend(ClientCommand& command) {
+    std::scoped_lock lock(buy_orderbook.queue_mut, sell_orderbook.queue_mut);
+    EventJournal::defer();
+    amend_unlocked(command);
+    // under the locks, see process_batch
+    EventJournal::flushDeferred();
 }
 
 // returns if opp order book is empty
@@ -38,92 +130,199 @@ void InstrumentOrders::handle_cancel_command(ClientCommand& command) {
 //     return false;    
 // }
 
+namespace {
+
+// reused by every match on this thread, so sweeps do not allocate
+thread_local std::vector<Execution> executions;
+
+}  // namespace
+
 void InstrumentOrders::match(ClientCommand& command) {
-    SyncCerr() << "in match command" << std::endl;
+    ENGINE_TRACE(TraceLevel::Debug, TraceEvent::MatchStarted, command.order_id, command.count);
+    HotPathStats::count(instrument_id, HotPathCounter::Orders);
     OrderBook& orderbook =
         command.type == input_buy ? buy_orderbook : sell_orderbook;
     OrderBook& opp_orderbook =
         command.type == input_buy ? sell_orderbook : buy_orderbook;
 
     while (command.count > 0) {
-        // bool is_opp_order_book_empty = add_order_if_opp_order_book_empty(command);
-        // if (is_opp_order_book_empty) {
-        //     return;
-        // }
-
-        std::unique_lock<std::mutex> opp_queue_lock(opp_orderbook.queue_mut);
-
-        /**
-         * This check may not be necessary, but in the case where the top order
-         * is deleted and there are mutliple waiting active orders that can't
-         * match, this will ensure some form of progress where orders are popped
-         * from the queue.
-         */
-        // if (other_orderbook.topOrderDeleted()) {
-        //     other_orderbook.resting_orders.pop();
-        //     continue;
-        // }
-
-        std::unique_lock<std::mutex> hash_lock(OrderBook::hashmap_mut);
-        std::optional<Order> opt_top_opp_resting_order =
-            opp_orderbook.tryGetTopOrder(opp_queue_lock, hash_lock);
-        hash_lock.unlock();
-        Order top_opp_resting_order;
-        while (true) {
-            SyncCerr() << "Entered infinite while loop" << std::endl;
-            while (!opt_top_opp_resting_order.has_value()) {
-                opp_queue_lock.unlock();
-                if (orderbook.lockQueuesAndHashAndAddOrder(command, buy_orderbook, sell_orderbook)) {
-                    return;
-                } else {
-                    SyncCerr() << "Tried adding order " << command.order_id << " but failed" << std::endl;
-                    opp_queue_lock.lock();
-                    hash_lock.lock();
-                    opt_top_opp_resting_order = opp_orderbook.tryGetTopOrder(opp_queue_lock, hash_lock);
-                    hash_lock.unlock();
-                }
-            }
-            SyncCerr() << "Got top opp resting order " << opt_top_opp_resting_order.value().order_id << std::endl;
-            top_opp_resting_order = opt_top_opp_resting_order.value();
-
-            if (!top_opp_resting_order.transactionable_with(command)) {
-                SyncCerr() << "Order " << command.order_id << " is not transactionable with any resting orders, will try to add while loop" << std::endl;
-                opt_top_opp_resting_order = std::nullopt;
-                continue;
-            } else {
-                SyncCerr() << "Order " << command.order_id << " is transactionable, executing" << std::endl;
-                break;
+        std::unique_lock opp_queue_lock(opp_orderbook.queue_mut);
+        if (!opp_orderbook.isTransactionableWith(command)) {
+            ENGINE_TRACE(TraceLevel::Debug, TraceEvent::NotTransactionable, command.order_id, 0);
+            opp_queue_lock.unlock();
+            if (orderbook.lockQueuesAndAddOrder(command, buy_orderbook, sell_orderbook)) {
+                return;
             }
+            // an opposing order that crosses arrived while opp_queue_lock was released, match against it
+            ENGINE_TRACE(TraceLevel::Info, TraceEvent::AddRaced, command.order_id, 0);
+            HotPathStats::count(instrument_id, HotPathCounter::AddRetries);
+            continue;
         }
-        SyncCerr() << "Order " << command.order_id << " is outside of infinite while loop" << std::endl;
-
-        // reaches this point if top_opposing_resting_order is transactionable with active order
-        // opp_queue_lock will be locked here; we also acquire hash_lock here so that top_opp_resting_order cannot be cancelled
-        hash_lock.lock();
-        if (command.count >= top_opp_resting_order.count) {
-            SyncCerr() << "Resting order " << top_opp_resting_order.order_id << " is fully executed" << std::endl;
-            if (!opp_orderbook.popTopOrder(opp_queue_lock, hash_lock)) {
-                // if the top order has already been executed, then continue
-                continue;
-            } else {
-                int64_t timestamp = getCurrentTimestamp();
-                opp_queue_lock.unlock();    // unlock early if we don't need to update the top order quantity
-                top_opp_resting_order.execute(command, timestamp);
-            }
-        } else {
-            // top_opp_resting_order is a copy of the order in the heap
-            // no way of editing an element in PQ in place, must pop and push from queue to update the quantity
-            // top_opp_resting_order.execute(command);
-            auto [transacted_qty, new_top_opp_resting_order] = top_opp_resting_order.getNewOrderAfterExecuting(command);
-            if (!opp_orderbook.updateTopOrder(new_top_opp_resting_order, opp_queue_lock, hash_lock)) {
-                // if the top order has already been executed, then continue
-                continue;
-            } else {
-                int64_t timestamp = getCurrentTimestamp();
-                opp_queue_lock.unlock();    // unlock early after updating top order quantity
-                Order::executeCommandAfterUnlockQueueLock(command, new_top_opp_resting_order.order_id, new_top_opp_resting_order.execution_id, new_top_opp_resting_order.price, transacted_qty, timestamp);
-            }
+
+        // every fill up to the order's quantity and limit in one critical section;
+        // the fills of a sweep share its timestamp
+        ENGINE_TRACE(TraceLevel::Debug, TraceEvent::Executing, command.order_id, opp_orderbook.topOrder()->order_id);
+        executions.clear();
+        opp_orderbook.sweep(command, executions);
+        int64_t timestamp = getCurrentTimestamp();
+        opp_queue_lock.unlock();    // unlock early, output does not need the book
+        emit_executions(command, executions, timestamp);
+    }
+}
+
+void InstrumentOrders::process_command_unlocked(ClientCommand& command) {
+    if (command.type == input_buy || command.type == input_sell) {
+        match_unlocked(command);
+    } else if (isImmediateOrder(command.type)) {
+        match_immediate_unlocked(command);
+    } else if (command.type == input_amend) {
+        amend_unlocked(command);
+    } else {
+        cancel_unlocked(command.order_id);
+    }
+}
+
+void InstrumentOrders::cancel_unlocked(uint32_t order_id) {
+    bool cancelled = buy_orderbook.removeOrder(order_id) || sell_orderbook.removeOrder(order_id);
+    if (cancelled) {
+        order_directory.erase(order_id);
+    }
+    count_cancel(cancelled);
+    EventJournal::OrderDeleted(order_id, cancelled, getCurrentTimestamp());
+}
+
+void InstrumentOrders::amend_unlocked(ClientCommand& command) {
+    OrderBook* orderbook = &buy_orderbook;
+    const Order* order = buy_orderbook.findOrder(command.order_id);
+    if (order == nullptr) {
+        orderbook = &sell_orderbook;
+        order = sell_orderbook.findOrder(command.order_id);
+    }
+    if (order == nullptr || command.count == 0) {
+        EventJournal::OrderDeleted(command.order_id, false, getCurrentTimestamp());
+        return;
+    }
+    if (orderbook->amendInPlace(command.order_id, command.price, command.count)) {
+        return;
+    }
+
+    // a moved order is reported and matched like a cancel and a new order, but in
+    // the same critical section and with its execution ids continuing
+    uint32_t execution_id = orderbook->detachOrder(command.order_id);
+    EventJournal::OrderDeleted(command.order_id, true, getCurrentTimestamp());
+    OrderBook& opp_orderbook = orderbook == &buy_orderbook ? sell_orderbook : buy_orderbook;
+    command.type = orderbook == &buy_orderbook ? input_buy : input_sell;
+    if (opp_orderbook.isTransactionableWith(command)) {
+        executions.clear();
+        opp_orderbook.sweep(command, executions);
+        emit_executions(command, executions, getCurrentTimestamp());
+    }
+    if (command.count > 0) {
+        orderbook->reattachOrder(command, execution_id);
+    } else {
+        orderbook->dropDetached(command.order_id);
+    }
+}
+
+void InstrumentOrders::count_cancel(bool cancelled) const {
+    HotPathStats::count(instrument_id, cancelled ? HotPathCounter::CancelsAccepted : HotPathCounter::CancelsRejected);
+}
+
+// same as match(), but with no other thread touching the books there is no lock
+// to release and retake between steps and adding can never race with another order
+void InstrumentOrders::match_unlocked(ClientCommand& command) {
+    HotPathStats::count(instrument_id, HotPathCounter::Orders);
+    OrderBook& orderbook =
+        command.type == input_buy ? buy_orderbook : sell_orderbook;
+    OrderBook& opp_orderbook =
+        command.type == input_buy ? sell_orderbook : buy_orderbook;
+
+    while (command.count > 0) {
+        if (!opp_orderbook.isTransactionableWith(command)) {
+            orderbook.addOrder(command);
+            return;
         }
+
+        executions.clear();
+        opp_orderbook.sweep(command, executions);
+        emit_executions(command, executions, getCurrentTimestamp());
+    }
+}
+
+// Immediate orders take the opposite book's lock once: everything they can fill
+// crosses now, and whatever is left is deleted instead of rested, so there is
+// no add to race with and neither the own book nor the directory is touched.
+void InstrumentOrders::match_immediate(ClientCommand& command) {
+    ENGINE_TRACE(TraceLevel::Debug, TraceEvent::MatchStarted, command.order_id, command.count);
+    HotPathStats::count(instrument_id, HotPathCounter::Orders);
+    OrderBook& opp_orderbook =
+        orderSide(command.type) == input_buy ? sell_orderbook : buy_orderbook;
+
+    std::unique_lock opp_queue_lock(opp_orderbook.queue_mut);
+    sweep_immediate(opp_orderbook, command);
+    int64_t timestamp = getCurrentTimestamp();
+    opp_queue_lock.unlock();
+    finish_immediate(command, timestamp);
+}
+
+void InstrumentOrders::match_immediate_unlocked(ClientCommand& command) {
+    HotPathStats::count(instrument_id, HotPathCounter::Orders);
+    OrderBook& opp_orderbook =
+        orderSide(command.type) == input_buy ? sell_orderbook : buy_orderbook;
+
+    sweep_immediate(opp_orderbook, command);
+    finish_immediate(command, getCurrentTimestamp());
+}
+
+void InstrumentOrders::sweep_immediate(OrderBook& opp_orderbook, ClientCommand& command) {
+    if (isMarketOrder(command.type)) {
+        command.price = marketOrderPrice(orderSide(command.type));
+    }
+    executions.clear();
+    // a fill-or-kill that cannot complete leaves the book as it is
+    if (isFillOrKill(command.type) && opp_orderbook.crossableQuantity(command.price, command.count) < command.count) {
+        return;
+    }
+    // sweep walks every crossed level, nothing is left to cross after it
+    opp_orderbook.sweep(command, executions);
+}
+
+void InstrumentOrders::finish_immediate(ClientCommand& command, int64_t timestamp) {
+    if (!executions.empty()) {
+        emit_executions(command, executions, timestamp);
     }
+    if (command.count > 0) {
+        EventJournal::OrderDeleted(command.order_id, true, timestamp);
+    }
+}
+
+void InstrumentOrders::emit_executions(ClientCommand& command, const std::vector<Execution>& executions, int64_t timestamp) {
+    HotPathStats::count(instrument_id, HotPathCounter::Sweeps);
+    HotPathStats::count(instrument_id, HotPathCounter::Fills, executions.size());
+    EventJournal::defer();
+    for (const Execution& execution : executions) {
+        executeCommandAfterUnlockQueueLock(command, execution.resting_order_id, execution.execution_id, execution.price, execution.count, timestamp);
+        retire_filled_orders(command, execution);
+    }
+    EventJournal::flushDeferred();
 }
 
+// drops fully executed orders from the directory, a later cancel for them is rejected either way
+void InstrumentOrders::retire_filled_orders(const ClientCommand& command, const Execution& execution) {
+    if (execution.resting_order_done) {
+        order_directory.erase(execution.resting_order_id);
+    }
+    if (command.count == 0 && !isImmediateOrder(command.type)) {
+        order_directory.erase(command.order_id);
+    }
+}
+
+OrderIndexStats InstrumentOrders::liveness_stats() const {
+    OrderIndexStats stats = buy_orderbook.livenessStats();
+    stats += sell_orderbook.livenessStats();
+    return stats;
+}
+
+OrderIndexStats InstrumentOrders::directory_stats() {
+    return order_directory.stats();
+}
@@ -1,20 +1,93 @@
 #ifndef INSTRUMENT_ORDERS_HPP
 #define INSTRUMENT_ORDERS_HPP
 
+#include <atomic>
+#include <span>
+
 #include "order_book.hpp"
+#include "order_directory.hpp"
+#include "order_types.hpp"
 
 class InstrumentOrders {
+    uint32_t instrument_id;
+    char instrument[9];
+    // sequence number of the next order added to either book
+    uint64_t next_sequence = 0;
+
     OrderBook buy_orderbook;
     OrderBook sell_orderbook;
 
+    // routes cancels to the instrument that owns the order
+    static OrderDirectory order_directory;
+
    public:
-    InstrumentOrders(): buy_orderbook(), sell_orderbook() {}
+    // index of the Matcher that owns this instrument in single-writer mode, or
+    // moving_matcher while it is handed to another one
+    std::atomic<uint32_t> matcher_idx{0};
+    static constexpr uint32_t moving_matcher = UINT32_MAX;
+    // threads between reading matcher_idx and handing this instrument's command or
+    // task to that matcher, counted only while instruments may move
+    std::atomic<uint32_t> routing{0};
+
+    InstrumentOrders(uint32_t instrument_id, const char* instrument);
     void process_command(ClientCommand& command);
     static void handle_cancel_command(ClientCommand& command);
+    static void handle_amend_command(ClientCommand& command);
+    // rejects a cancel or amend for an order no instrument knows
+    static void reject_unknown_order(uint32_t order_id);
+
+    // Processes a run of orders of any type for this instrument in arrival order,
+    // taking both queue locks once for the whole run instead of for every match
+    // step; the run's events are emitted together at its end.
+    void process_batch(std::span<ClientCommand> commands);
+
+    // Single-writer mode: the calling thread must be the only one touching this
+    // instrument, no locks are taken. Limit orders must already be registered.
+    void process_command_unlocked(ClientCommand& command);
+
+    // Whether command is an order that may end up resting, and so has to be
+    // registered for cancels. Immediate orders never rest, and a limit order for
+    // nothing neither rests nor fills, so it would never be erased again.
+    static bool may_rest(const ClientCommand& command) { return !isImmediateOrder(command.type) && command.count > 0; }
+    static void register_order(uint32_t order_id, InstrumentOrders* instrument_orders);
+    // returns nullptr if order_id is not registered or already terminal
+    static InstrumentOrders* find_order(uint32_t order_id);
+
+    // resting orders of both books; safe to call while other threads match
+    OrderIndexStats liveness_stats() const;
+    static OrderIndexStats directory_stats();
+
+    const char* name() const { return instrument; }
+
+    // for snapshots and recovery, which arrange exclusive access themselves
+    OrderBook& orderbook(CommandType side) { return side == input_buy ? buy_orderbook : sell_orderbook; }
+
+    // lock-free market data of one side, safe to use while other threads match
+    MarketDepth& market_depth(CommandType side) {
+        return side == input_buy ? buy_orderbook.marketDepth() : sell_orderbook.marketDepth();
+    }
 
    private:
+    void cancel(uint32_t order_id);
+    void amend(ClientCommand& command);
     void handle_buy_sell_command(ClientCommand& command);
     void match(ClientCommand& command);
+
+    void cancel_unlocked(uint32_t order_id);
+    void amend_unlocked(ClientCommand& command);
+    void count_cancel(bool cancelled) const;
+    void match_unlocked(ClientCommand& command);
+
+    // IOC/FOK/market orders: one sweep of the opposite book, never resting
+    void match_immediate(ClientCommand& command);
+    void match_immediate_unlocked(ClientCommand& command);
+    // the sweep itself, caller holds the opposite book's queue_mut or owns the instrument
+    void sweep_immediate(OrderBook& opp_orderbook, ClientCommand& command);
+    void finish_immediate(ClientCommand& command, int64_t timestamp);
+
+    // emits the executions of one sweep as a batch and retires the orders they filled
+    void emit_executions(ClientCommand& command, const std::vector<Execution>& executions, int64_t timestamp);
+    void retire_filled_orders(const ClientCommand& command, const Execution& execution);
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,138 @@
+// Client commands coming in and output events going out: the wire format of a
+// command, the connection it is read from, and the lines the engine prints.
+
+#ifndef IO_HPP
+#define IO_HPP
+
+#include <unistd.h>
+
+#include <cinttypes>
+#include <cstdint>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <utility>
+
+enum CommandType {
+    input_buy = 'B',
+    input_sell = 'S',
+    input_cancel = 'C',
+};
+
+// sent by clients as is, one struct per command
+struct ClientCommand {
+    CommandType type;
+    uint32_t order_id;
+    uint32_t price;
+    uint32_t count;
+    char instrument[9];
+};
+
+enum class ReadResult {
+    Success,
+    EndOfFile,
+    Error,
+};
+
+// Owns the socket of one client and closes it when destroyed.
+class ClientConnection {
+    int m_fd = -1;
+
+   public:
+    explicit ClientConnection(int fd) : m_fd(fd) {}
+    ~ClientConnection() { freeHandle(); }
+
+    ClientConnection(const ClientConnection&) = delete;
+    ClientConnection& operator=(const ClientConnection&) = delete;
+    ClientConnection(ClientConnection&& other) noexcept : m_fd(std::exchange(other.m_fd, -1)) {}
+    ClientConnection& operator=(ClientConnection&& other) noexcept {
+        freeHandle();
+        m_fd = std::exchange(other.m_fd, -1);
+        return *this;
+    }
+
+    // Reads one command. On a non-blocking socket, a read with nothing buffered is
+    // an Error with errno EAGAIN, and so is one with less than a whole command
+    // buffered, which also consumes those bytes: callers should wait until a whole
+    // command is buffered.
+    ReadResult readInput(ClientCommand& read_into) {
+        switch (read(m_fd, &read_into, sizeof(read_into))) {
+            case 0:
+                return ReadResult::EndOfFile;
+            case sizeof(read_into):
+                return ReadResult::Success;
+            default:
+                return ReadResult::Error;
+        }
+    }
+
+    // the socket, e.g. to wait for input with epoll; still owned by the connection
+    int fd() const { return m_fd; }
+
+    void freeHandle() {
+        if (m_fd != -1) {
+            close(m_fd);
+        }
+        m_fd = -1;
+    }
+};
+
+// Collects one message and writes it to stderr in one piece when destroyed:
+//   SyncCerr{} << "Error reading input" << std::endl;
+struct SyncCerr {
+    inline static std::mutex mut;
+    std::stringstream stream;
+
+    SyncCerr() = default;
+    SyncCerr(const SyncCerr&) = delete;
+    SyncCerr& operator=(const SyncCerr&) = delete;
+    ~SyncCerr() {
+        std::scoped_lock lock(mut);
+        std::cerr << stream.rdbuf();
+    }
+
+    template <typename T>
+    friend SyncCerr& operator<<(SyncCerr& s, const T& value) {
+        s.stream << value;
+        return s;
+    }
+    template <typename T>
+    friend SyncCerr&& operator<<(SyncCerr&& s, const T& value) {
+        s.stream << value;
+        return std::move(s);
+    }
+    friend SyncCerr& operator<<(SyncCerr& s, std::ostream& (*manipulator)(std::ostream&)) {
+        s.stream << manipulator;
+        return s;
+    }
+    friend SyncCerr&& operator<<(SyncCerr&& s, std::ostream& (*manipulator)(std::ostream&)) {
+        s.stream << manipulator;
+        return std::move(s);
+    }
+};
+
+// Output events, one line each on stdout; lines are never interleaved.
+struct Output {
+    inline static std::mutex mut;
+
+    static void OrderAdded(uint32_t id, const char* symbol, uint32_t price, uint32_t count, bool is_sell_side,
+                           intmax_t output_timestamp) {
+        std::scoped_lock lock(mut);
+        std::cout << (is_sell_side ? "S " : "B ") << id << " " << symbol << " " << price << " " << count << " "
+                  << output_timestamp << std::endl;
+    }
+
+    static void OrderExecuted(uint32_t resting_id, uint32_t new_id, uint32_t execution_id, uint32_t price,
+                              uint32_t count, intmax_t output_timestamp) {
+        std::scoped_lock lock(mut);
+        std::cout << "E " << resting_id << " " << new_id << " " << execution_id << " " << price << " " << count
+                  << " " << output_timestamp << std::endl;
+    }
+
+    static void OrderDeleted(uint32_t id, bool cancel_accepted, intmax_t output_timestamp) {
+        std::scoped_lock lock(mut);
+        std::cout << "X " << id << " " << (cancel_accepted ? "A" : "R") << " " << output_timestamp << std::endl;
+    }
+};
+
+#endif
@@ -0,0 +1,188 @@
+#include "io_worker_pool.hpp"
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+IoWorkerPool::IoWorkerPool(size_t num_workers, const std::vector<int>& cpus, CommandHandler handler)
+    : handler(std::move(handler)) {
+    for (size_t i = 0; i < num_workers; ++i) {
+        auto worker = std::make_unique<Worker>();
+        worker->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+        worker->wakeup_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        epoll_event event{};
+        event.events = EPOLLIN;
+        event.data.fd = worker->wakeup_fd;
+        epoll_ctl(worker->epoll_fd, EPOLL_CTL_ADD, worker->wakeup_fd, &event);
+
+        worker->thread = std::thread(&IoWorkerPool::run, this, std::ref(*worker));
+        if (i < cpus.size()) {
+            cpu_set_t cpu_set;
+            CPU_ZERO(&cpu_set);
+            CPU_SET(cpus[i], &cpu_set);
+            if (pthread_setaffinity_np(worker->thread.native_handle(), sizeof(cpu_set), &cpu_set) != 0) {
+                SyncCerr() << "Failed to pin I/O worker to cpu " << cpus[i] << std::endl;
+            }
+        }
+        workers.push_back(std::move(worker));
+    }
+}
+
+IoWorkerPool::~IoWorkerPool() {
+    stop();
+    for (auto& worker : workers) {
+        close(worker->epoll_fd);
+        close(worker->wakeup_fd);
+    }
+}
+
+void IoWorkerPool::add(ClientConnection connection) {
+    int fd = connection.fd();
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+    Worker& worker = *workers[next_worker.fetch_add(1, std::memory_order_relaxed) % workers.size()];
+    {
+        // checked under pending_mut, which the worker also holds when deciding to exit
+        std::scoped_lock lock(worker.pending_mut);
+        if (draining.load() || stopping.load()) {
+            return;     // the connection is closed when it goes out of scope
+        }
+        worker.pending_sessions.push_back(std::make_unique<Session>(std::move(connection)));
+    }
+    wake(worker);
+}
+
+void IoWorkerPool::drain() {
+    draining.store(true);
+    for (auto& worker : workers) {
+        wake(*worker);
+    }
+    joinAll();
+}
+
+void IoWorkerPool::stop() {
+    stopping.store(true);
+    for (auto& worker : workers) {
+        wake(*worker);
+    }
+    joinAll();
+}
+
+void IoWorkerPool::joinAll() {
+    for (auto& worker : workers) {
+        if (worker->thread.joinable()) {
+            worker->thread.join();
+        }
+    }
+}
+
+void IoWorkerPool::wake(Worker& worker) {
+    uint64_t one = 1;
+    [[maybe_unused]] ssize_t written = write(worker.wakeup_fd, &one, sizeof(one));
+}
+
+void IoWorkerPool::adoptPendingSessions(Worker& worker) {
+    std::vector<std::unique_ptr<Session>> pending_sessions;
+    {
+        std::scoped_lock lock(worker.pending_mut);
+        pending_sessions.swap(worker.pending_sessions);
+    }
+    for (auto& session : pending_sessions) {
+        epoll_event event{};
+        // edge triggered: a partial command left buffered must not wake the worker
+        // again until more of it arrives
+        event.events = EPOLLIN | EPOLLRDHUP | EPOLLET;
+        int fd = session->connection.fd();
+        event.data.fd = fd;
+        if (epoll_ctl(worker.epoll_fd, EPOLL_CTL_ADD, fd, &event) != 0) {
+            SyncCerr() << "Failed to watch connection: " << std::strerror(errno) << std::endl;
+            continue;
+        }
+        worker.sessions.emplace(fd, std::move(session));
+    }
+}
+
+void IoWorkerPool::run(Worker& worker) {
+    epoll_event events[max_events_per_wait];
+    while (true) {
+        if (stopping.load()) {
+            worker.sessions.clear();
+            std::scoped_lock lock(worker.pending_mut);
+            worker.pending_sessions.clear();
+            return;
+        }
+        if (draining.load()) {
+            std::scoped_lock lock(worker.pending_mut);
+            if (worker.sessions.empty() && worker.pending_sessions.empty()) {
+                return;
+            }
+        }
+
+        int num_events = epoll_wait(worker.epoll_fd, events, max_events_per_wait, -1);
+        if (num_events < 0) {
+            if (errno != EINTR) {
+                SyncCerr() << "epoll_wait failed: " << std::strerror(errno) << std::endl;
+            }
+            continue;
+        }
+
+        for (int i = 0; i < num_events; ++i) {
+            int fd = events[i].data.fd;
+            if (fd == worker.wakeup_fd) {
+                uint64_t count;
+                [[maybe_unused]] ssize_t bytes_read = read(worker.wakeup_fd, &count, sizeof(count));
+                adoptPendingSessions(worker);
+                continue;
+            }
+
+            auto it = worker.sessions.find(fd);
+            if (it == worker.sessions.end()) {
+                continue;
+            }
+            if (!readSession(*it->second, events[i].events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR))) {
+                epoll_ctl(worker.epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+                worker.sessions.erase(it);
+            }
+        }
+    }
+}
+
+bool IoWorkerPool::readSession(Session& session, bool hung_up) {
+    // edge triggered, so read until nothing but a partial command is left
+    while (true) {
+        int buffered = 0;
+        if (ioctl(session.connection.fd(), FIONREAD, &buffered) != 0) {
+            buffered = 0;
+        }
+        size_t num_commands = std::min(static_cast<size_t>(buffered) / sizeof(ClientCommand), max_commands_per_read);
+        if (num_commands == 0) {
+            // readInput would consume a partial command, leave it until the rest
+            // arrives; the client can send nothing more once it hung up, then
+            // readInput reports the end of the input or the partial command
+            if (!hung_up) {
+                return true;
+            }
+            if (session.connection.readInput(session.commands[0]) == ReadResult::Error) {
+                SyncCerr() << "Error reading input" << std::endl;
+            }
+            return false;
+        }
+        // whole commands that are already buffered, so each read returns one
+        for (size_t i = 0; i < num_commands; ++i) {
+            if (session.connection.readInput(session.commands[i]) != ReadResult::Success) {
+                handler(std::span<ClientCommand>(session.commands, i), session.state);
+                SyncCerr() << "Error reading input" << std::endl;
+                return false;
+            }
+        }
+        handler(std::span<ClientCommand>(session.commands, num_commands), session.state);
+    }
+}
@@ -0,0 +1,81 @@
+#ifndef IO_WORKER_POOL_HPP
+#define IO_WORKER_POOL_HPP
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "client_state.hpp"
+#include "io.hpp"
+
+// Fixed pool of I/O threads that serve many client connections each.
+// Every worker waits on its own epoll instance and, per wakeup, reads as many
+// whole ClientCommands as are buffered on a non-blocking socket with
+// ClientConnection::readInput, handing them to the callback in batches of up to
+// max_commands_per_read. A partially received command stays in the socket until
+// the rest of it arrives. A connection is only ever served by one worker,
+// so its commands are handled in the order they were sent.
+class IoWorkerPool {
+   public:
+    using CommandHandler = std::function<void(std::span<ClientCommand>, ClientState&)>;
+
+   private:
+    static constexpr size_t max_commands_per_read = 256;
+    static constexpr int max_events_per_wait = 64;
+
+    struct Session {
+        ClientConnection connection;
+        ClientState state;
+        ClientCommand commands[max_commands_per_read];
+
+        explicit Session(ClientConnection connection) : connection(std::move(connection)) {}
+    };
+
+    struct Worker {
+        int epoll_fd = -1;
+        // written to wake the worker up for new sessions, drain and stop
+        int wakeup_fd = -1;
+        std::thread thread;
+
+        std::mutex pending_mut;
+        std::vector<std::unique_ptr<Session>> pending_sessions;
+        // only touched by the worker thread
+        std::unordered_map<int, std::unique_ptr<Session>> sessions;
+    };
+
+    CommandHandler handler;
+    std::vector<std::unique_ptr<Worker>> workers;
+    std::atomic<size_t> next_worker{0};
+    std::atomic<bool> draining{false};
+    std::atomic<bool> stopping{false};
+
+   public:
+    // cpus[i] pins worker i when given
+    IoWorkerPool(size_t num_workers, const std::vector<int>& cpus, CommandHandler handler);
+    IoWorkerPool(const IoWorkerPool&) = delete;
+    IoWorkerPool& operator=(const IoWorkerPool&) = delete;
+    ~IoWorkerPool();
+
+    void add(ClientConnection connection);
+
+    // waits until every client closed its connection and all its commands were handled
+    void drain();
+    // closes all connections right away, commands that were already read are still handled
+    void stop();
+
+   private:
+    void run(Worker& worker);
+    void wake(Worker& worker);
+    void adoptPendingSessions(Worker& worker);
+    // returns false once the session should be closed; hung_up if epoll reported
+    // that the client closed its end
+    bool readSession(Session& session, bool hung_up);
+    void joinAll();
+};
+
+#endif
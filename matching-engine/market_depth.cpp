@@ -0,0 +1,43 @@
+#include "market_depth.hpp"
+
+MarketDepth::MarketDepth() {
+    if (update_ring_capacity > 0) {
+        updates = std::make_unique<SpscRing<LevelUpdate>>(update_ring_capacity);
+    }
+}
+
+void MarketDepth::recordUpdate(CommandType side, uint32_t price, uint32_t num_orders, uint64_t quantity) {
+    ++update_sequence;
+    if (updates) {
+        // dropped when full, the consumer sees the gap in sequence
+        if (!updates->tryPush(LevelUpdate{update_sequence, quantity, price, num_orders, side})) {
+            dropped_updates.store(dropped_updates.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        }
+    }
+}
+
+DepthSnapshot MarketDepth::snapshot() const {
+    DepthSnapshot snapshot;
+    while (true) {
+        uint64_t before = version.load(std::memory_order_acquire);
+        if (before & 1) {
+            continue;
+        }
+        snapshot.num_levels = num_levels.load(std::memory_order_relaxed);
+        snapshot.sequence = published_sequence.load(std::memory_order_relaxed);
+        for (uint32_t i = 0; i < snapshot.num_levels; ++i) {
+            uint64_t price_orders = levels[i].price_orders.load(std::memory_order_relaxed);
+            snapshot.levels[i] = DepthLevel{static_cast<uint32_t>(price_orders >> 32), static_cast<uint32_t>(price_orders),
+                                            levels[i].quantity.load(std::memory_order_relaxed)};
+        }
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (version.load(std::memory_order_relaxed) == before) {
+            snapshot.dropped_updates = dropped_updates.load(std::memory_order_relaxed);
+            return snapshot;
+        }
+    }
+}
+
+bool MarketDepth::pollUpdate(LevelUpdate& update) {
+    return updates && updates->tryPop(update);
+}
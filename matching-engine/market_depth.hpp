@@ -0,0 +1,106 @@
+#ifndef MARKET_DEPTH_HPP
+#define MARKET_DEPTH_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+
+#include "io.hpp"
+#include "spsc_ring.hpp"
+
+// Aggregated resting quantity at one price.
+struct DepthLevel {
+    uint32_t price;
+    uint32_t num_orders;
+    uint64_t quantity;
+};
+
+// Top of one side of a book, best price first.
+struct DepthSnapshot {
+    static constexpr size_t max_levels = 10;
+
+    // sequence of the last LevelUpdate reflected in the snapshot
+    uint64_t sequence = 0;
+    // level updates the stream of this side dropped so far because its consumer
+    // fell behind; not part of the seqlocked levels, it may be a little newer
+    uint64_t dropped_updates = 0;
+    uint32_t num_levels = 0;
+    DepthLevel levels[max_levels];
+};
+
+// Change of one price level; quantity 0 means the level is gone.
+struct LevelUpdate {
+    // per book, increases by one with every level change, even when the update
+    // stream is disabled or full, so consumers can detect gaps
+    uint64_t sequence;
+    uint64_t quantity;
+    uint32_t price;
+    uint32_t num_orders;
+    CommandType side;
+};
+
+// Read-only market data of one side of a book.
+//
+// Written only by whoever holds the book's queue_mut (or its single-writer
+// matcher) and read by any number of threads that never take a lock: the top
+// levels are published through a seqlock, so a reader retries if a write
+// overlapped its copy but never makes the writer wait. Level changes can also be
+// streamed through a bounded ring; when the consumer falls behind updates are
+// dropped, which shows as a gap in sequence, and it resynchronises from a snapshot.
+class MarketDepth {
+    struct PackedLevel {
+        // price << 32 | num_orders
+        std::atomic<uint64_t> price_orders{0};
+        std::atomic<uint64_t> quantity{0};
+    };
+
+    // odd while a write is in progress
+    alignas(64) std::atomic<uint64_t> version{0};
+    std::atomic<uint64_t> published_sequence{0};
+    std::atomic<uint32_t> num_levels{0};
+    PackedLevel levels[DepthSnapshot::max_levels];
+
+    // writer side
+    alignas(64) uint64_t update_sequence = 0;
+    // only written by the writer, atomic so that snapshots can read it
+    std::atomic<uint64_t> dropped_updates{0};
+    std::unique_ptr<SpscRing<LevelUpdate>> updates;
+
+   public:
+    // Capacity of the level update ring of every book created afterwards, a power
+    // of two; 0 (the default) disables the update stream.
+    static inline size_t update_ring_capacity = 0;
+
+    MarketDepth();
+
+    // Writer side, the caller must own the book.
+
+    void recordUpdate(CommandType side, uint32_t price, uint32_t num_orders, uint64_t quantity);
+
+    // f(i) returns the i-th best level, for i below num_levels
+    template <typename F>
+    void publish(uint32_t new_num_levels, F level_at) {
+        new_num_levels = std::min<uint32_t>(new_num_levels, DepthSnapshot::max_levels);
+        uint64_t current = version.load(std::memory_order_relaxed);
+        version.store(current + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        for (uint32_t i = 0; i < new_num_levels; ++i) {
+            DepthLevel level = level_at(i);
+            levels[i].price_orders.store(uint64_t(level.price) << 32 | level.num_orders, std::memory_order_relaxed);
+            levels[i].quantity.store(level.quantity, std::memory_order_relaxed);
+        }
+        num_levels.store(new_num_levels, std::memory_order_relaxed);
+        published_sequence.store(update_sequence, std::memory_order_relaxed);
+        version.store(current + 2, std::memory_order_release);
+    }
+
+    // Reader side.
+
+    // never blocks the writer, safe from any thread
+    DepthSnapshot snapshot() const;
+    // single consumer only, returns false if there is no update or no stream
+    bool pollUpdate(LevelUpdate& update);
+};
+
+#endif
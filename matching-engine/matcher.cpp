@@ -0,0 +1,154 @@
+#include "matcher.hpp"
+
+#include <pthread.h>
+#include <sched.h>
+
+#include <condition_variable>
+
+#include "order_types.hpp"
+
+Matcher::Matcher(size_t ring_capacity, int cpu) : commands(ring_capacity) {
+    thread = std::thread(&Matcher::run, this);
+    if (cpu >= 0) {
+        cpu_set_t cpu_set;
+        CPU_ZERO(&cpu_set);
+        CPU_SET(cpu, &cpu_set);
+        if (pthread_setaffinity_np(thread.native_handle(), sizeof(cpu_set), &cpu_set) != 0) {
+            SyncCerr() << "Failed to pin matcher to cpu " << cpu << std::endl;
+        }
+    }
+}
+
+Matcher::~Matcher() {
+    stop();
+}
+
+void Matcher::push(const MatcherCommand& command) {
+    while (!commands.tryPush(command)) {
+        std::this_thread::yield();
+    }
+    wake();
+}
+
+// Pairs with park(): either the matcher sees what was published before the fence,
+// or this sees it parked and wakes it.
+void Matcher::wake() {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (parked.load(std::memory_order_relaxed)) {
+        wakeups.fetch_add(1, std::memory_order_release);
+        wakeups.notify_one();
+    }
+}
+
+void Matcher::park() {
+    uint32_t seen = wakeups.load(std::memory_order_acquire);
+    parked.store(true, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (commands.empty() && !has_tasks.load(std::memory_order_acquire) && running.load(std::memory_order_acquire)) {
+        wakeups.wait(seen, std::memory_order_acquire);
+    }
+    parked.store(false, std::memory_order_relaxed);
+}
+
+void Matcher::execute(const std::function<void()>& task) {
+    std::mutex done_mut;
+    std::condition_variable done_cv;
+    bool done = false;
+    bool queued = false;
+    {
+        std::scoped_lock lock(tasks_mut);
+        if (!exited) {
+            tasks.push_back([&] {
+                task();
+                std::scoped_lock done_lock(done_mut);
+                done = true;
+                done_cv.notify_all();
+            });
+            has_tasks.store(true, std::memory_order_release);
+            queued = true;
+        }
+    }
+    wake();
+    if (!queued) {
+        task();
+        return;
+    }
+    std::unique_lock<std::mutex> done_lock(done_mut);
+    done_cv.wait(done_lock, [&] { return done; });
+}
+
+void Matcher::barrier() {
+    push(MatcherCommand{ClientCommand{}, nullptr});
+    uint64_t target = ++barriers_pushed;
+    while (barriers_passed.load(std::memory_order_acquire) < target) {
+        std::this_thread::yield();
+    }
+}
+
+void Matcher::run_tasks() {
+    std::vector<std::function<void()>> pending;
+    {
+        std::scoped_lock lock(tasks_mut);
+        pending.swap(tasks);
+        has_tasks.store(false, std::memory_order_relaxed);
+    }
+    for (auto& task : pending) {
+        task();
+    }
+}
+
+void Matcher::stop() {
+    running.store(false, std::memory_order_release);
+    wake();
+    if (thread.joinable()) {
+        thread.join();
+    }
+}
+
+void Matcher::run() {
+    MatcherCommand matcher_command;
+    unsigned idle_spins = 0;
+    while (true) {
+        if (has_tasks.load(std::memory_order_acquire)) {
+            run_tasks();
+        }
+        if (commands.tryPop(matcher_command)) {
+            idle_spins = 0;
+            process(matcher_command);
+            continue;
+        }
+        // the ring is drained before stopping, so no accepted command is dropped
+        if (!running.load(std::memory_order_acquire)) {
+            if (!commands.tryPop(matcher_command)) {
+                // tasks queued from now on run on their caller's thread
+                std::scoped_lock lock(tasks_mut);
+                exited = true;
+                for (auto& task : tasks) {
+                    task();
+                }
+                tasks.clear();
+                return;
+            }
+            process(matcher_command);
+            continue;
+        }
+        if (++idle_spins > idle_spins_before_park) {
+            park();
+            idle_spins = 0;
+        } else if (idle_spins > idle_spins_before_yield) {
+            std::this_thread::yield();
+        }
+    }
+}
+
+void Matcher::process(MatcherCommand& matcher_command) {
+    if (matcher_command.instrument_orders == nullptr) {
+        if (targetsRestingOrder(matcher_command.command.type)) {
+            InstrumentOrders::reject_unknown_order(matcher_command.command.order_id);
+            return;
+        }
+        barriers_passed.fetch_add(1, std::memory_order_release);
+        return;
+    }
+    matcher_command.instrument_orders->process_command_unlocked(matcher_command.command);
+}
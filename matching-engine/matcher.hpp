@@ -0,0 +1,78 @@
+#ifndef MATCHER_HPP
+#define MATCHER_HPP
+
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "instrument_orders.hpp"
+#include "mpsc_ring.hpp"
+
+// A command routed to the matcher that owns its instrument.
+struct MatcherCommand {
+    ClientCommand command;
+    // nullptr for a cancel or amend of an order that is not resting anywhere,
+    // which is rejected, and otherwise marks a barrier
+    InstrumentOrders* instrument_orders;
+};
+
+// Single-writer matching: one thread owns a set of instruments and is the only
+// thread that ever touches their books, so it matches without taking any lock.
+// Connection threads hand commands over through a bounded lock-free ring, which
+// keeps the output order of each instrument deterministic.
+class Matcher {
+    MpscRing<MatcherCommand> commands;
+    std::atomic<bool> running{true};
+    std::thread thread;
+
+    // work that needs the matcher's instruments to itself, run between commands
+    std::mutex tasks_mut;
+    std::vector<std::function<void()>> tasks;
+    std::atomic<bool> has_tasks{false};
+    // set by the matcher thread once it no longer runs tasks
+    bool exited = false;
+
+    // barriers pushed by barrier() and passed by the matcher thread
+    uint64_t barriers_pushed = 0;
+    std::atomic<uint64_t> barriers_passed{0};
+
+    // An idle matcher spins for a while, then yields, then parks until a push,
+    // task or stop bumps wakeups. Pushers only touch wakeups while it is parked.
+    static constexpr unsigned idle_spins_before_yield = 1024;
+    static constexpr unsigned idle_spins_before_park = 2048;
+    std::atomic<bool> parked{false};
+    std::atomic<uint32_t> wakeups{0};
+
+   public:
+    // cpu < 0 leaves the thread unpinned
+    Matcher(size_t ring_capacity, int cpu);
+    Matcher(const Matcher&) = delete;
+    Matcher& operator=(const Matcher&) = delete;
+    ~Matcher();
+
+    // blocks while the ring is full
+    void push(const MatcherCommand& command);
+
+    // Runs task on the matcher thread between two commands and waits for it,
+    // or on the calling thread once the matcher stopped.
+    void execute(const std::function<void()>& task);
+
+    // Returns once every command pushed before the call has been matched. One
+    // caller at a time, and only before stop().
+    void barrier();
+
+    // processes everything already pushed, then joins the thread
+    void stop();
+
+   private:
+    void run();
+    void process(MatcherCommand& matcher_command);
+    void run_tasks();
+    // waits until there may be something to do
+    void park();
+    void wake();
+};
+
+#endif
@@ -0,0 +1,78 @@
+#ifndef MPSC_RING_HPP
+#define MPSC_RING_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+// Bounded lock-free multi-producer single-consumer ring.
+// Each cell carries a sequence number: a producer may write cell pos once its
+// sequence equals pos, and the consumer may read it once it equals pos + 1.
+// Items pushed by one producer are popped in the order they were pushed.
+template <typename T>
+class MpscRing {
+    struct Cell {
+        std::atomic<size_t> sequence;
+        T value;
+    };
+
+    std::unique_ptr<Cell[]> cells;
+    size_t mask;
+
+    alignas(64) std::atomic<size_t> enqueue_pos{0};
+    // only touched by the consumer
+    alignas(64) size_t dequeue_pos = 0;
+
+   public:
+    // capacity must be a power of two
+    explicit MpscRing(size_t capacity) : cells(new Cell[capacity]), mask(capacity - 1) {
+        for (size_t i = 0; i < capacity; ++i) {
+            cells[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    MpscRing(const MpscRing&) = delete;
+    MpscRing& operator=(const MpscRing&) = delete;
+
+    // returns false if the ring is full
+    bool tryPush(const T& value) {
+        Cell* cell;
+        size_t pos = enqueue_pos.load(std::memory_order_relaxed);
+        while (true) {
+            cell = &cells[pos & mask];
+            size_t sequence = cell->sequence.load(std::memory_order_acquire);
+            intptr_t diff = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos);
+            if (diff == 0) {
+                if (enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = enqueue_pos.load(std::memory_order_relaxed);
+            }
+        }
+        cell->value = value;
+        cell->sequence.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    // must only be called by the consumer
+    bool empty() const { return cells[dequeue_pos & mask].sequence.load(std::memory_order_acquire) != dequeue_pos + 1; }
+
+    // returns false if the ring is empty; must only be called by the consumer
+    bool tryPop(T& value) {
+        Cell& cell = cells[dequeue_pos & mask];
+        size_t sequence = cell.sequence.load(std::memory_order_acquire);
+        if (sequence != dequeue_pos + 1) {
+            return false;
+        }
+        value = cell.value;
+        cell.sequence.store(dequeue_pos + mask + 1, std::memory_order_release);
+        ++dequeue_pos;
+        return true;
+    }
+};
+
+#endif
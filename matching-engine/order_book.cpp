@@ -1,153 +1,288 @@
 #include "order_book.hpp"
-#include "io.hpp"
 
-std::unordered_map<uint32_t, bool> OrderBook::executed_orders;
-std::mutex OrderBook::hashmap_mut;
+#include <algorithm>
 
-void OrderBook::addOrderToHashMap(uint32_t order_id, std::unique_lock<std::mutex>& hash_lock) {
-    if (!hash_lock.owns_lock()) {
-        hash_lock.lock();
-    }
-    executed_orders[order_id] = false;
-}
+#include "io.hpp"
+#include "price_search.hpp"
+#include "trace.hpp"
 
-void OrderBook::updateExecutedOrderInHashMap(uint32_t order_id, std::unique_lock<std::mutex>& hash_lock) {
-    if (!hash_lock.owns_lock()) {
-        hash_lock.lock();
-    }
-    executed_orders[order_id] = true;
+OrderIndexStats OrderBook::livenessStats() const {
+    OrderIndexStats stats = order_handles.stats();
+    stats.bytes += orders.bytes();
+    return stats;
 }
 
 // maintains the invariant that all opposing type resting orders are never transactionable with each other
-bool OrderBook::lockQueuesAndHashAndAddOrder(ClientCommand command, OrderBook& buy_orderbook, OrderBook& sell_orderbook) {
-    std::lock(buy_orderbook.queue_mut, sell_orderbook.queue_mut, hashmap_mut);
-    std::unique_lock<std::mutex> buy_queue_lock(buy_orderbook.queue_mut, std::adopt_lock);
-    std::unique_lock<std::mutex> sell_queue_lock(sell_orderbook.queue_mut, std::adopt_lock);
-    std::unique_lock<std::mutex> hash_lock(hashmap_mut, std::adopt_lock);
+bool OrderBook::lockQueuesAndAddOrder(ClientCommand command, OrderBook& buy_orderbook, OrderBook& sell_orderbook) {
+    std::scoped_lock lock(buy_orderbook.queue_mut, sell_orderbook.queue_mut);
 
     OrderBook& orderbook = command.type == input_buy ? buy_orderbook : sell_orderbook;
     OrderBook& opp_orderbook = command.type == input_buy ? sell_orderbook : buy_orderbook;
-    std::unique_lock<std::mutex>& opp_queue_lock = command.type == input_buy ? buy_queue_lock : sell_queue_lock;
-
-    std::optional<Order> opp_resting_order = opp_orderbook.tryGetTopOrder(opp_queue_lock, hash_lock);
 
-    if (opp_resting_order.has_value() && opp_resting_order.value().transactionable_with(command)) {
+    if (opp_orderbook.isTransactionableWith(command)) {
         return false;
     } else {
-        SyncCerr() << "Adding to resting order" << std::endl;
-        Order resting_order = Order(command);
-        orderbook.resting_orders.push(resting_order);
-        SyncCerr() << "After adding, orderbook is size " << orderbook.resting_orders.size() << ", opp orderbook is size " << opp_orderbook.resting_orders.size() << std::endl;
-        Output::OrderAdded(resting_order.order_id, resting_order.instrument,
-                        resting_order.price, resting_order.count,
-                        resting_order.type == input_sell,
-                        resting_order.timestamp);
-        orderbook.addOrderToHashMap(command.order_id, hash_lock);
+        orderbook.addOrder(command);
+        ENGINE_TRACE(TraceLevel::Debug, TraceEvent::OrderRested, command.order_id, orderbook.levels.size());
         return true;
     }
 }
 
-bool OrderBook::lockHashmapAndDeleteOrder(uint32_t order_id) {
-    std::unique_lock<std::mutex> hash_lock(hashmap_mut);
+size_t OrderBook::crossedLevels(uint32_t price) const {
+    // buy levels ascend towards the best price, sell levels descend
+    return side == input_buy ? PriceSearch::suffixAtLeast(level_prices.data(), level_prices.size(), price)
+                             : PriceSearch::suffixAtMost(level_prices.data(), level_prices.size(), price);
+}
 
-    if (executed_orders.count(order_id) == 0 || executed_orders[order_id]) {
-        Output::OrderDeleted(order_id, false, getCurrentTimestamp());
-    } else {
-        executed_orders[order_id] = true;
-        Output::OrderDeleted(order_id, true, getCurrentTimestamp());
+uint64_t OrderBook::crossableQuantity(uint32_t price, uint64_t wanted) const {
+    uint64_t quantity = 0;
+    for (size_t crossed = crossedLevels(price), level_idx = levels.size(); crossed > 0 && quantity < wanted; --crossed) {
+        quantity += levels[--level_idx].quantity;
     }
+    return quantity;
+}
 
-    return true;
+// the levels price is not better than are exactly the ones it would cross
+size_t OrderBook::findLevel(uint32_t price) const {
+    return levels.size() - crossedLevels(price);
 }
 
-// bool OrderBook::topOrderDeleted() {
-//     std::unique_lock<std::mutex> lock(hashmap_mut);
-//     const Order& top_resting_order = resting_orders.top();
-//     return executed_orders[top_resting_order.order_id];
-// }
+void OrderBook::addOrder(ClientCommand command) {
+    HotPathStats::count(instrument_id, HotPathCounter::Rested);
+    const Order& order = insertOrder(command.order_id, command.price, command.count, 0);
+    logWal(WalOp::Rested, order.order_id, order.price, order.count);
+    reportAdded(order);
+}
 
-bool OrderBook::popTopOrder(std::unique_lock<std::mutex>& queue_lock, std::unique_lock<std::mutex>& hash_lock) {
-   if (!queue_lock.owns_lock() || !hash_lock.owns_lock()) {
-        if (queue_lock.owns_lock()) queue_lock.unlock();
-        if (hash_lock.owns_lock()) hash_lock.unlock();
-        queue_lock.lock();
-        hash_lock.lock();
-    }
-    Order order = resting_orders.top();
-    resting_orders.pop();
-    
-    if (executed_orders[order.order_id]) {
+const Order* OrderBook::findOrder(uint32_t order_id) {
+    OrderHandle* handle = order_handles.find(order_id);
+    return handle == nullptr ? nullptr : &orders.get(*handle);
+}
+
+bool OrderBook::amendInPlace(uint32_t order_id, uint32_t price, uint32_t count) {
+    Order& order = orders.get(*order_handles.find(order_id));
+    if (order.price != price || count > order.count) {
         return false;
-    } else {
-        updateExecutedOrderInHashMap(order.order_id, hash_lock);
     }
-
+    reduceOrder(order, count);
+    logWal(WalOp::Amended, order_id, price, count);
+    reportAdded(order);
     return true;
 }
 
-bool OrderBook::updateTopOrder(Order top_order, std::unique_lock<std::mutex>& queue_lock, std::unique_lock<std::mutex>& hash_lock) {
-   if (!queue_lock.owns_lock() || !hash_lock.owns_lock()) {
-        if (queue_lock.owns_lock()) queue_lock.unlock();
-        if (hash_lock.owns_lock()) hash_lock.unlock();
-        queue_lock.lock();
-        hash_lock.lock();
-    }
-    Order order = resting_orders.top();
-    resting_orders.pop();
+uint32_t OrderBook::detachOrder(uint32_t order_id) {
+    OrderHandle handle = *order_handles.find(order_id);
+    const Order& order = orders.get(handle);
+    uint32_t execution_id = order.execution_id;
+    unlinkOrder(handle, findLevel(order.price));
+    return execution_id;
+}
+
+void OrderBook::reattachOrder(const ClientCommand& command, uint32_t execution_id) {
+    const Order& order = insertOrder(command.order_id, command.price, command.count, execution_id);
+    logWal(WalOp::Amended, order.order_id, order.price, order.count);
+    reportAdded(order);
+}
+
+void OrderBook::dropDetached(uint32_t order_id) {
+    logWal(WalOp::Removed, order_id, 0, 0);
+}
 
-    if (executed_orders[order.order_id]) {
+void OrderBook::reportAdded(const Order& order) {
+    EventJournal::OrderAdded(order.order_id, instrument,
+                    order.price, order.count,
+                    side == input_sell,
+                    getCurrentTimestamp());
+}
+
+void OrderBook::restoreOrder(uint32_t order_id, uint32_t price, uint32_t count, uint32_t execution_id) {
+    insertOrder(order_id, price, count, execution_id);
+}
+
+bool OrderBook::restoreFill(uint32_t order_id, uint32_t count) {
+    OrderHandle* handle = order_handles.find(order_id);
+    if (handle == nullptr) {
         return false;
+    }
+    OrderHandle order_handle = *handle;
+    Order& order = orders.get(order_handle);
+    size_t level_idx = findLevel(order.price);
+    uint32_t transacted_qty = std::min(order.count, count);
+    order.count -= transacted_qty;
+    order.execution_id += 1;
+    levels[level_idx].quantity -= transacted_qty;
+    if (order.count == 0) {
+        unlinkOrder(order_handle, level_idx);
     } else {
-        resting_orders.push(top_order);
-        return true;
+        levelChanged(level_idx);
+        publishDepthIfTop(level_idx, levels.size());
     }
+    return true;
 }
 
-std::optional<Order> OrderBook::tryGetTopOrder(std::unique_lock<std::mutex>& queue_lock, std::unique_lock<std::mutex>& hash_lock) {
-    if (!queue_lock.owns_lock() || !hash_lock.owns_lock()) {
-        if (queue_lock.owns_lock()) queue_lock.unlock();
-        if (hash_lock.owns_lock()) hash_lock.unlock();
-        queue_lock.lock();
-        hash_lock.lock();
+bool OrderBook::restoreAmend(uint32_t order_id, uint32_t price, uint32_t count) {
+    OrderHandle* handle = order_handles.find(order_id);
+    if (handle == nullptr) {
+        return false;
+    }
+    OrderHandle order_handle = *handle;
+    Order& order = orders.get(order_handle);
+    if (order.price == price && count <= order.count) {
+        reduceOrder(order, count);
+        return true;
     }
+    uint32_t execution_id = order.execution_id;
+    unlinkOrder(order_handle, findLevel(order.price));
+    insertOrder(order_id, price, count, execution_id);
+    return true;
+}
+
+void OrderBook::reduceOrder(Order& order, uint32_t count) {
+    size_t level_idx = findLevel(order.price);
+    levels[level_idx].quantity -= order.count - count;
+    order.count = count;
+    levelChanged(level_idx);
+    publishDepthIfTop(level_idx, levels.size());
+}
 
-    popTillTopOrderNotEnded(queue_lock, hash_lock);
+Order& OrderBook::insertOrder(uint32_t order_id, uint32_t price, uint32_t count, uint32_t execution_id) {
+    OrderHandle handle = orders.allocate();
+    Order& order = orders.get(handle);
+    order.order_id = order_id;
+    order.price = price;
+    order.count = count;
+    order.execution_id = execution_id;
+    order.sequence = next_sequence++;
+    order_handles.insert(order_id, handle);
 
-    if (resting_orders.size() > 0) {
-        return resting_orders.top();
+    size_t level_idx = findLevel(price);
+    if (level_idx == levels.size() || level_prices[level_idx] != price) {
+        level_prices.insert(level_prices.begin() + level_idx, price);
+        levels.insert(levels.begin() + level_idx, PriceLevel{});
+    }
+
+    PriceLevel& level = levels[level_idx];
+    order.prev = level.tail;
+    order.next = null_order_handle;
+    if (level.tail != null_order_handle) {
+        orders.get(level.tail).next = handle;
     } else {
-        return std::nullopt;
+        level.head = handle;
     }
+    level.tail = handle;
+    level.num_orders += 1;
+    level.quantity += order.count;
+    levelChanged(level_idx);
+    publishDepthIfTop(level_idx, levels.size());
+    return order;
 }
 
-void OrderBook::popTillTopOrderNotEnded(std::unique_lock<std::mutex>& queue_lock, std::unique_lock<std::mutex>& hash_lock) {
-    if (!queue_lock.owns_lock() || !hash_lock.owns_lock()) {
-        if (queue_lock.owns_lock()) queue_lock.unlock();
-        if (hash_lock.owns_lock()) hash_lock.unlock();
-        queue_lock.lock();
-        hash_lock.lock();
+void OrderBook::unlinkOrder(OrderHandle handle, size_t level_idx) {
+    PriceLevel& level = levels[level_idx];
+    Order& order = orders.get(handle);
+    if (order.prev != null_order_handle) {
+        orders.get(order.prev).next = order.next;
+    } else {
+        level.head = order.next;
+    }
+    if (order.next != null_order_handle) {
+        orders.get(order.next).prev = order.prev;
+    } else {
+        level.tail = order.prev;
     }
+    level.num_orders -= 1;
+    level.quantity -= order.count;
+    levelChanged(level_idx);
 
-    Order top_order;
-    while (resting_orders.size() > 0) {
-        top_order = resting_orders.top();
-        if (executed_orders[top_order.order_id]) {
-            resting_orders.pop();
+    size_t num_levels_before = levels.size();
+    if (level.head == null_order_handle) {
+        level_prices.erase(level_prices.begin() + level_idx);
+        levels.erase(levels.begin() + level_idx);
+    }
+    publishDepthIfTop(level_idx, num_levels_before);
+
+    order_handles.erase(order.order_id);
+    orders.release(handle);
+}
+
+void OrderBook::sweep(const ClientCommand& command, std::vector<Execution>& executions) {
+    uint32_t remaining = command.count;
+    for (size_t crossed = crossedLevels(command.price); remaining > 0 && crossed > 0; --crossed) {
+        PriceLevel& level = levels.back();
+        uint32_t price = level_prices.back();
+        while (remaining > 0 && level.head != null_order_handle) {
+            OrderHandle handle = level.head;
+            Order& order = orders.get(handle);
+            uint32_t transacted_qty = std::min(order.count, remaining);
+            order.count -= transacted_qty;
+            order.execution_id += 1;
+            remaining -= transacted_qty;
+            level.quantity -= transacted_qty;
+            executions.push_back(Execution{order.order_id, order.execution_id, price, transacted_qty, order.count == 0});
+            logWal(WalOp::Filled, order.order_id, price, transacted_qty);
+            if (order.count != 0) {
+                break;
+            }
+            level.head = order.next;
+            level.num_orders -= 1;
+            order_handles.erase(order.order_id);
+            orders.release(handle);
+        }
+
+        levelChanged(levels.size() - 1);
+        if (level.head == null_order_handle) {
+            level_prices.pop_back();
+            levels.pop_back();
         } else {
-            break;
+            orders.get(level.head).prev = null_order_handle;
         }
     }
+    publishDepth();
+}
+
+bool OrderBook::removeOrder(uint32_t order_id) {
+    OrderHandle* handle = order_handles.find(order_id);
+    if (handle == nullptr) {
+        return false;
+    }
+    OrderHandle order_handle = *handle;
+    const Order& order = orders.get(order_handle);
+    logWal(WalOp::Removed, order.order_id, order.price, order.count);
+    unlinkOrder(order_handle, findLevel(order.price));
+    return true;
+}
+
+void OrderBook::levelChanged(size_t level_idx) {
+    const PriceLevel& level = levels[level_idx];
+    depth.recordUpdate(side, level_prices[level_idx], level.num_orders, level.quantity);
 }
 
-bool OrderBook::isOrdersQueueEmpty(std::unique_lock<std::mutex>& queue_lock, std::unique_lock<std::mutex>& hash_lock) {
-    if (!queue_lock.owns_lock() || !hash_lock.owns_lock()) {
-        if (queue_lock.owns_lock()) queue_lock.unlock();
-        if (hash_lock.owns_lock()) hash_lock.unlock();
-        queue_lock.lock();
-        hash_lock.lock();
+void OrderBook::publishDepthIfTop(size_t level_idx, size_t num_levels_before) {
+    // levels below the published ones can change without moving any published level
+    if (level_idx + DepthSnapshot::max_levels >= num_levels_before) {
+        publishDepth();
     }
+}
 
-    popTillTopOrderNotEnded(queue_lock, hash_lock);
+void OrderBook::publishDepth() {
+    size_t num_levels = levels.size();
+    depth.publish(num_levels, [this, num_levels](uint32_t i) {
+        size_t level_idx = num_levels - 1 - i;
+        return DepthLevel{level_prices[level_idx], levels[level_idx].num_orders, levels[level_idx].quantity};
+    });
+}
 
-    return resting_orders.size() == 0;
-}
\ No newline at end of file
+void OrderBook::logWal(WalOp op, uint32_t order_id, uint32_t price, uint32_t count) {
+    if (!WriteAheadLog::enabled()) {
+        return;
+    }
+    WalRecord record{};
+    record.book_sequence = ++wal_sequence;
+    std::memcpy(record.instrument, instrument, strnlen(instrument, sizeof(record.instrument)));
+    record.order_id = order_id;
+    record.price = price;
+    record.count = count;
+    record.op = op;
+    record.side = static_cast<uint8_t>(side);
+    WriteAheadLog::append(record);
+}
@@ -2,137 +2,185 @@
 #define ORDER_BOOK_HPP
 
 #include <cstring>
-#include <queue>
+#include <mutex>
 #include <string>
-#include <unordered_map>
-#include <optional>
+#include <vector>
 
 // #include "engine.hpp"
+#include "clock.hpp"
+#include "event_journal.hpp"
+#include "hot_path_stats.hpp"
 #include "io.hpp"
+#include "market_depth.hpp"
+#include "order_index.hpp"
+#include "order_pool.hpp"
+#include "write_ahead_log.hpp"
 
-inline std::chrono::microseconds::rep getCurrentTimestamp() noexcept {
-    return std::chrono::duration_cast<std::chrono::nanoseconds>(
-               std::chrono::steady_clock::now().time_since_epoch())
-        .count();
+inline int64_t getCurrentTimestamp() noexcept {
+    return Clock::now();
 }
 
-struct Order {
-    CommandType type;
-    uint32_t order_id;
-    uint32_t price;
-    uint32_t count;
-    char instrument[9];
-    uint32_t execution_id;
-    intmax_t timestamp;
-
-    Order() = default;
-
-    Order(CommandType type, uint32_t order_id, uint32_t price, uint32_t count, const char* instrument, uint32_t execution_id, intmax_t timestamp)
-    : type(type),
-      order_id(order_id),
-      price(price),
-      count(count),
-      execution_id(execution_id),
-      timestamp(timestamp) {
-        strncpy(this->instrument, instrument, sizeof(this->instrument) - 1);
-        timestamp = getCurrentTimestamp();
-      }
-
-    Order(ClientCommand active_order)
-        : type(active_order.type),
-          order_id(active_order.order_id),
-          price(active_order.price),
-          count(active_order.count),
-          execution_id(0) {
-        strncpy(instrument, active_order.instrument, sizeof(instrument) - 1);
-        timestamp = getCurrentTimestamp();
-    }
-
-    bool transactionable_with(ClientCommand command) const {
-        if (type != command.type) {
-            if (type == input_buy) {
-                return price >= command.price;
-            } else {
-                return price <= command.price;
-            }
-        }
-        return false;
-    }
-
-    void execute(ClientCommand& command, int64_t timestamp) {
-        uint32_t transacted_price = price;
-        uint32_t transacted_qty = std::min(count, command.count);
-        count -= transacted_qty;
-        command.count -= transacted_qty;
-        execution_id += 1;
-        Output::OrderExecuted(order_id, command.order_id, execution_id,
-                              transacted_price, transacted_qty,
-                              timestamp);
-    }
-
-    // returns transacted_qty
-    std::pair<uint32_t, Order> getNewOrderAfterExecuting(ClientCommand& command) {
-        uint32_t transacted_qty = std::min(count, command.count);
-        uint32_t new_count = count - transacted_qty;
-        uint32_t new_execution_id = execution_id + 1;
-        return std::pair(transacted_qty, Order(type, order_id, price, new_count, instrument, new_execution_id, timestamp));
-    }
+// FIFO of the resting orders at one price, oldest order at head.
+struct PriceLevel {
+    OrderHandle head = null_order_handle;
+    OrderHandle tail = null_order_handle;
+    // aggregates of the orders in the FIFO, for market data
+    uint32_t num_orders = 0;
+    uint64_t quantity = 0;
+};
 
-    static void executeCommandAfterUnlockQueueLock(ClientCommand& command, uint32_t order_id, uint32_t execution_id, uint32_t transacted_price, uint32_t transacted_qty, int64_t timestamp) {
-        command.count -= transacted_qty;
-        Output::OrderExecuted(order_id, command.order_id, execution_id,
-                              transacted_price, transacted_qty,
-                              timestamp);
-    }
+inline void executeCommandAfterUnlockQueueLock(ClientCommand& command, uint32_t order_id, uint32_t execution_id, uint32_t transacted_price, uint32_t transacted_qty, int64_t timestamp) {
+    command.count -= transacted_qty;
+    EventJournal::OrderExecuted(order_id, command.order_id, execution_id,
+                          transacted_price, transacted_qty,
+                          timestamp);
+}
 
-    bool operator<(const Order& other) const {
-        if (type == input_buy) {
-            if (price != other.price) return price < other.price;
-            return timestamp > other.timestamp;
-        } else {
-            if (price != other.price) return price > other.price;
-            return timestamp > other.timestamp;
-        }
-    }
+// One fill of a resting order by OrderBook::sweep.
+struct Execution {
+    uint32_t resting_order_id;
+    uint32_t execution_id;
+    uint32_t price;
+    uint32_t count;
+    // the resting order is fully executed and no longer in the book
+    bool resting_order_done;
 };
 
 class OrderBook {
    public:
     // to ensure no deadlocks
-        // both queue mut must be acquired at once (e.g. with scoped_lock or lock);
-        // and if queue and hashmap mut are both needed, hashmap_mut is always acquired after queue
-    std::mutex queue_mut;
-    static std::mutex hashmap_mut;
-  
-   private:
-    std::priority_queue<Order> resting_orders;
+        // both queue mut must be acquired at once (e.g. with scoped_lock or lock)
+    InstrumentedMutex<LockKind::BookQueue> queue_mut;
 
-    // ended_orders[order_id] = false means order_id is a resting order, yet to be executed fully
-    // ended_order[order_id] = true means order_id has been executed fully
-    static std::unordered_map<uint32_t, bool> executed_orders;
+   private:
+    CommandType side;
+    uint32_t instrument_id;
+    // owned by the InstrumentOrders of this book, used for output
+    const char* instrument;
+    // owned by the InstrumentOrders of this book and shared with the opposite book;
+    // only used when adding, which holds both queue locks
+    uint64_t& next_sequence;
+
+    // Price ladder, sorted from worst to best price so the best level is at the back
+    // and levels are usually created/removed near the end of the arrays.
+    // level_prices[i] is the price of levels[i]; kept in a separate array so price
+    // searches only touch prices.
+    std::vector<uint32_t> level_prices;
+    std::vector<PriceLevel> levels;
+
+    // storage of the orders resting in this book
+    OrderPool orders;
+    // order_id -> handle of every order resting in this book; an order is live iff it is in here
+    // and is erased as soon as it is filled or cancelled
+    OrderIndex<OrderHandle> order_handles;
+
+    // top levels and level changes of this book, for readers that must not lock
+    MarketDepth depth;
+
+    // sequence of the last write-ahead log record of this book; records of one
+    // book are only written under its queue_mut, so this orders them
+    uint64_t wal_sequence = 0;
 
    public:
-    // Below methods are not thread safe. At most, deleteOrder() and
-    // topOrderDeletedCheck() lock the hash table mutex.
+    OrderBook(CommandType side, uint32_t instrument_id, const char* instrument, uint64_t& next_sequence)
+        : side(side), instrument_id(instrument_id), instrument(instrument), next_sequence(next_sequence) {}
+    OrderBook(const OrderBook&) = delete;
+    OrderBook& operator=(const OrderBook&) = delete;
 
-    static bool lockQueuesAndHashAndAddOrder(ClientCommand command, OrderBook& buy_orderbook, OrderBook& sell_orderbook);
+    // buy_orderbook and sell_orderbook must belong to the same instrument
+    static bool lockQueuesAndAddOrder(ClientCommand command, OrderBook& buy_orderbook, OrderBook& sell_orderbook);
 
-    // NOTE: should only be called when queue mut is not locked, i.e. during a cancel command
-    static bool lockHashmapAndDeleteOrder(uint32_t order_id);
-    // bool topOrderDeleted();
+    // Below methods are not thread safe, the caller must hold queue_mut.
 
-    bool isOrdersQueueEmpty(std::unique_lock<std::mutex>& queue_lock, std::unique_lock<std::mutex>& hash_lock);
+    bool isOrdersQueueEmpty() const { return levels.empty(); }
 
-    std::optional<Order> tryGetTopOrder(std::unique_lock<std::mutex>& queue_lock, std::unique_lock<std::mutex>& hash_lock);
+    // oldest order at the best price, nullptr if the book is empty
+    const Order* topOrder() const { return levels.empty() ? nullptr : &orders.get(levels.back().head); }
 
-    bool popTopOrder(std::unique_lock<std::mutex>& queue_lock, std::unique_lock<std::mutex>& hash_lock);
+    // true if the best resting order can trade with command, which is on the other side
+    bool isTransactionableWith(const ClientCommand& command) const {
+        return !levels.empty() && !isBetterPrice(command.price, level_prices.back());
+    }
 
-    bool updateTopOrder(Order top_order, std::unique_lock<std::mutex>& queue_lock, std::unique_lock<std::mutex>& hash_lock);
+    // number of levels, from the best one, that an incoming price on the other side crosses
+    size_t crossedLevels(uint32_t price) const;
+
+    // resting quantity an incoming price on the other side crosses, summed level by
+    // level from the best one and stopping once it reaches wanted; the book is not modified
+    uint64_t crossableQuantity(uint32_t price, uint64_t wanted) const;
+
+    // Fills resting orders from the top of the book until command, which is on the
+    // other side, is filled or no longer crosses, appending one Execution per fill.
+    // Fully filled orders and emptied levels are dropped as the walk passes them.
+    // command itself is not modified.
+    void sweep(const ClientCommand& command, std::vector<Execution>& executions);
+
+    // emits OrderAdded for the order now resting in the book
+    void addOrder(ClientCommand command);
+
+    // unlinks order_id immediately, returns false if it is not resting in this book
+    bool removeOrder(uint32_t order_id);
+
+    // nullptr if order_id is not resting in this book
+    const Order* findOrder(uint32_t order_id);
+
+    // Amends. order_id must be resting in this book.
+    // Lowers the count of an order at its own price in place, keeping its priority,
+    // and emits OrderAdded with the new count; returns false for any other amend.
+    bool amendInPlace(uint32_t order_id, uint32_t price, uint32_t count);
+    // unlinks the order for an amend that moves it and returns its execution id; nothing
+    // is emitted or logged until the amend ends with reattachOrder() or dropDetached()
+    uint32_t detachOrder(uint32_t order_id);
+    // rests the detached order at its new price and count behind the orders already
+    // there, with its execution ids continuing, and emits OrderAdded
+    void reattachOrder(const ClientCommand& command, uint32_t execution_id);
+    // the detached order was filled completely at its new price
+    void dropDetached(uint32_t order_id);
+
+    // Recovery only: no events and no write-ahead log records.
+    // Orders must be restored in priority order.
+    void restoreOrder(uint32_t order_id, uint32_t price, uint32_t count, uint32_t execution_id);
+    // returns false if order_id is not resting in this book
+    bool restoreFill(uint32_t order_id, uint32_t count);
+    // returns false if order_id is not resting in this book
+    bool restoreAmend(uint32_t order_id, uint32_t price, uint32_t count);
+    uint64_t walSequence() const { return wal_sequence; }
+    void setWalSequence(uint64_t sequence) { wal_sequence = sequence; }
+
+    // calls f(const Order&) for every resting order in priority order
+    template <typename F>
+    void forEachOrder(F f) const {
+        for (size_t level_idx = levels.size(); level_idx-- > 0;) {
+            for (OrderHandle handle = levels[level_idx].head; handle != null_order_handle;) {
+                const Order& order = orders.get(handle);
+                f(order);
+                handle = order.next;
+            }
+        }
+    }
+
+    // may be called without holding queue_mut
+    OrderIndexStats livenessStats() const;
+    // may be called without holding queue_mut, see MarketDepth for who may read what
+    MarketDepth& marketDepth() { return depth; }
 
-  private:
-    void addOrderToHashMap(uint32_t order_id, std::unique_lock<std::mutex>& hash_lock);
-    void updateExecutedOrderInHashMap(uint32_t order_id, std::unique_lock<std::mutex>& hash_lock);
-    void popTillTopOrderNotEnded(std::unique_lock<std::mutex>& queue_lock, std::unique_lock<std::mutex>& hash_lock);
+   private:
+    // true if price a has priority over price b on this side of the book
+    bool isBetterPrice(uint32_t a, uint32_t b) const { return side == input_buy ? a > b : a < b; }
+
+    // index of the first level whose price is not worse than price
+    size_t findLevel(uint32_t price) const;
+    void unlinkOrder(OrderHandle handle, size_t level_idx);
+    Order& insertOrder(uint32_t order_id, uint32_t price, uint32_t count, uint32_t execution_id);
+    void reduceOrder(Order& order, uint32_t count);
+    void logWal(WalOp op, uint32_t order_id, uint32_t price, uint32_t count);
+    void reportAdded(const Order& order);
+
+    // reports the level at level_idx after a change, before it is erased if empty
+    void levelChanged(size_t level_idx);
+    // republishes the top levels if level_idx, taken before the change, is among them
+    void publishDepthIfTop(size_t level_idx, size_t num_levels_before);
+    void publishDepth();
 };
 
 #endif
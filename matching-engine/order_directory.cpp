@@ -0,0 +1,28 @@
+#include "order_directory.hpp"
+
+void OrderDirectory::insert(uint32_t order_id, InstrumentOrders* instrument_orders) {
+    Stripe& stripe = stripeFor(order_id);
+    std::scoped_lock lock(stripe.mut);
+    stripe.instruments.insert(order_id, instrument_orders);
+}
+
+InstrumentOrders* OrderDirectory::find(uint32_t order_id) {
+    Stripe& stripe = stripeFor(order_id);
+    std::scoped_lock lock(stripe.mut);
+    InstrumentOrders** instrument_orders = stripe.instruments.find(order_id);
+    return instrument_orders == nullptr ? nullptr : *instrument_orders;
+}
+
+void OrderDirectory::erase(uint32_t order_id) {
+    Stripe& stripe = stripeFor(order_id);
+    std::scoped_lock lock(stripe.mut);
+    stripe.instruments.erase(order_id);
+}
+
+OrderIndexStats OrderDirectory::stats() const {
+    OrderIndexStats stats;
+    for (const Stripe& stripe : stripes) {
+        stats += stripe.instruments.stats();
+    }
+    return stats;
+}
@@ -0,0 +1,42 @@
+#ifndef ORDER_DIRECTORY_HPP
+#define ORDER_DIRECTORY_HPP
+
+#include <array>
+#include <cstdint>
+#include <mutex>
+
+#include "hot_path_stats.hpp"
+#include "order_index.hpp"
+
+class InstrumentOrders;
+
+// Global order_id -> instrument directory, used to route a cancel (which only
+// carries an order_id) to the InstrumentOrders that owns the order.
+// The map is split into stripes keyed on order_id so that registering and
+// looking up orders of different instruments rarely contend on the same mutex.
+// Orders are erased again once terminal, so the directory only holds live orders.
+class OrderDirectory {
+    static constexpr size_t num_stripes = 64;
+
+    struct alignas(64) Stripe {
+        InstrumentedMutex<LockKind::OrderDirectory> mut;
+        OrderIndex<InstrumentOrders*> instruments;
+    };
+
+    std::array<Stripe, num_stripes> stripes;
+
+   public:
+    void insert(uint32_t order_id, InstrumentOrders* instrument_orders);
+
+    // returns nullptr if order_id is not registered
+    InstrumentOrders* find(uint32_t order_id);
+
+    void erase(uint32_t order_id);
+
+    OrderIndexStats stats() const;
+
+   private:
+    Stripe& stripeFor(uint32_t order_id) { return stripes[order_id % num_stripes]; }
+};
+
+#endif
@@ -0,0 +1,148 @@
+#ifndef ORDER_INDEX_HPP
+#define ORDER_INDEX_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+struct OrderIndexStats {
+    // orders currently tracked
+    size_t live = 0;
+    // orders ever erased once terminal
+    size_t retired = 0;
+    size_t bytes = 0;
+
+    OrderIndexStats& operator+=(const OrderIndexStats& other) {
+        live += other.live;
+        retired += other.retired;
+        bytes += other.bytes;
+        return *this;
+    }
+};
+
+// Open-addressing order_id -> V table with linear probing.
+// Erasing shifts the following entries of the probe run back instead of leaving
+// tombstones, and the table shrinks again once mostly empty, so its footprint
+// follows the number of live orders rather than the number ever seen.
+// Not thread safe, but stats() may be called from any thread.
+template <typename V>
+class OrderIndex {
+    static constexpr size_t min_capacity = 16;
+
+    struct Slot {
+        uint32_t key;
+        bool used;
+        V value;
+    };
+
+    std::vector<Slot> slots;
+    size_t mask;
+    // atomics only so that stats() can be read while another thread writes
+    std::atomic<size_t> live{0};
+    std::atomic<size_t> retired{0};
+    std::atomic<size_t> capacity;
+
+   public:
+    OrderIndex() : slots(min_capacity), mask(min_capacity - 1), capacity(min_capacity) {}
+
+    V* find(uint32_t key) {
+        for (size_t i = home(key);; i = (i + 1) & mask) {
+            Slot& slot = slots[i];
+            if (!slot.used) {
+                return nullptr;
+            }
+            if (slot.key == key) {
+                return &slot.value;
+            }
+        }
+    }
+
+    // overwrites the value if key is already present
+    void insert(uint32_t key, V value) {
+        if ((live.load(std::memory_order_relaxed) + 1) * 4 > slots.size() * 3) {
+            rehash(slots.size() * 2);
+        }
+        size_t i = home(key);
+        while (slots[i].used && slots[i].key != key) {
+            i = (i + 1) & mask;
+        }
+        if (!slots[i].used) {
+            slots[i].used = true;
+            slots[i].key = key;
+            live.store(live.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        }
+        slots[i].value = value;
+    }
+
+    // returns false if key is not present
+    bool erase(uint32_t key) {
+        size_t i = home(key);
+        while (true) {
+            if (!slots[i].used) {
+                return false;
+            }
+            if (slots[i].key == key) {
+                break;
+            }
+            i = (i + 1) & mask;
+        }
+
+        // move back every later entry of the run that may not sit before its home slot
+        size_t hole = i;
+        for (size_t j = (i + 1) & mask; slots[j].used; j = (j + 1) & mask) {
+            size_t j_home = home(slots[j].key);
+            if (((j - j_home) & mask) >= ((j - hole) & mask)) {
+                slots[hole] = slots[j];
+                hole = j;
+            }
+        }
+        slots[hole].used = false;
+
+        live.store(live.load(std::memory_order_relaxed) - 1, std::memory_order_relaxed);
+        retired.store(retired.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        if (slots.size() > min_capacity && live.load(std::memory_order_relaxed) * 8 < slots.size()) {
+            rehash(slots.size() / 2);
+        }
+        return true;
+    }
+
+    template <typename F>
+    void forEach(F f) {
+        for (Slot& slot : slots) {
+            if (slot.used) {
+                f(slot.key, slot.value);
+            }
+        }
+    }
+
+    OrderIndexStats stats() const {
+        return OrderIndexStats{live.load(std::memory_order_relaxed),
+                               retired.load(std::memory_order_relaxed),
+                               capacity.load(std::memory_order_relaxed) * sizeof(Slot)};
+    }
+
+   private:
+    size_t home(uint32_t key) const {
+        // Fibonacci hashing, order ids are often sequential
+        return static_cast<size_t>((key * 0x9E3779B97F4A7C15ull) >> 32) & mask;
+    }
+
+    void rehash(size_t new_capacity) {
+        std::vector<Slot> old_slots(new_capacity);
+        old_slots.swap(slots);
+        mask = new_capacity - 1;
+        capacity.store(new_capacity, std::memory_order_relaxed);
+        for (Slot& slot : old_slots) {
+            if (!slot.used) {
+                continue;
+            }
+            size_t i = home(slot.key);
+            while (slots[i].used) {
+                i = (i + 1) & mask;
+            }
+            slots[i] = slot;
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,72 @@
+#ifndef ORDER_POOL_HPP
+#define ORDER_POOL_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// 32-bit reference to an Order inside an OrderPool.
+using OrderHandle = uint32_t;
+constexpr OrderHandle null_order_handle = UINT32_MAX;
+
+// Hot part of a resting order, two to a cache line.
+// The side and instrument of an order are the same for its whole book, so they are
+// kept once by the OrderBook instead of in every order.
+struct alignas(32) Order {
+    uint32_t order_id;
+    uint32_t price;
+    uint32_t count;
+    uint32_t execution_id;
+    // time priority: orders of an instrument are numbered in the order they were
+    // added, so orders in a level's FIFO always have increasing sequence numbers
+    uint64_t sequence;
+    // neighbours in the FIFO of the price level, next doubles as the free list link
+    OrderHandle prev;
+    OrderHandle next;
+};
+
+static_assert(sizeof(Order) == 32);
+
+// Slab allocator for the orders of one book.
+// Orders are carved out of fixed-size slabs that are never moved or returned, so
+// handles and references stay valid, and freed orders are reused through a free
+// list before a new slab is touched. Not thread safe, but bytes() may be called
+// from any thread.
+class OrderPool {
+    static constexpr uint32_t slab_bits = 12;
+    static constexpr uint32_t slab_size = 1 << slab_bits;
+
+    std::vector<std::unique_ptr<Order[]>> slabs;
+    OrderHandle free_list = null_order_handle;
+    // handles at or above this were never handed out
+    uint32_t num_carved = 0;
+    // slabs.size() for bytes(), which must not read the vector while it grows
+    std::atomic<size_t> num_slabs{0};
+
+   public:
+    OrderHandle allocate() {
+        if (free_list != null_order_handle) {
+            OrderHandle handle = free_list;
+            free_list = get(handle).next;
+            return handle;
+        }
+        if (num_carved == slabs.size() * slab_size) {
+            slabs.emplace_back(new Order[slab_size]);
+            num_slabs.store(slabs.size(), std::memory_order_relaxed);
+        }
+        return num_carved++;
+    }
+
+    void release(OrderHandle handle) {
+        get(handle).next = free_list;
+        free_list = handle;
+    }
+
+    Order& get(OrderHandle handle) { return slabs[handle >> slab_bits][handle & (slab_size - 1)]; }
+    const Order& get(OrderHandle handle) const { return slabs[handle >> slab_bits][handle & (slab_size - 1)]; }
+
+    size_t bytes() const { return num_slabs.load(std::memory_order_relaxed) * slab_size * sizeof(Order); }
+};
+
+#endif
@@ -0,0 +1,54 @@
+#ifndef ORDER_TYPES_HPP
+#define ORDER_TYPES_HPP
+
+#include <cstdint>
+#include <limits>
+
+#include "io.hpp"
+
+// Order types beyond the resting limit orders of io.hpp, carried in ClientCommand::type
+// like them: uppercase buys, lowercase sells. None of them ever rests in a book or is
+// registered for cancels; whatever is left unfilled is deleted right away, reported
+// as an accepted OrderDeleted after the order's executions.
+//   immediate-or-cancel: fills what crosses its limit price
+//   fill-or-kill: fills its whole count within its limit price, or nothing
+//   market: fills what is in the book at any price, price is ignored
+inline constexpr CommandType input_buy_ioc = static_cast<CommandType>('I');
+inline constexpr CommandType input_sell_ioc = static_cast<CommandType>('i');
+inline constexpr CommandType input_buy_fok = static_cast<CommandType>('F');
+inline constexpr CommandType input_sell_fok = static_cast<CommandType>('f');
+inline constexpr CommandType input_buy_market = static_cast<CommandType>('M');
+inline constexpr CommandType input_sell_market = static_cast<CommandType>('m');
+
+// Amends the resting order order_id to price and count, routed by order_id like a
+// cancel; instrument is ignored. Lowering only the count keeps the order's priority
+// and emits OrderAdded with the new count. Any other change makes it a new arrival at
+// its new price, reported like a cancel followed by a new order: an accepted
+// OrderDeleted, executions if it crosses, OrderAdded for what rests. Rejected like a
+// cancel if the order is not resting or count is 0.
+inline constexpr CommandType input_amend = static_cast<CommandType>('A');
+
+// commands that name a resting order rather than an instrument
+inline bool targetsRestingOrder(CommandType type) { return type == input_cancel || type == input_amend; }
+
+inline bool isFillOrKill(CommandType type) { return type == input_buy_fok || type == input_sell_fok; }
+
+inline bool isMarketOrder(CommandType type) { return type == input_buy_market || type == input_sell_market; }
+
+inline bool isImmediateOrder(CommandType type) {
+    return type == input_buy_ioc || type == input_sell_ioc || isFillOrKill(type) || isMarketOrder(type);
+}
+
+// input_buy or input_sell, the book side of any order type
+inline CommandType orderSide(CommandType type) {
+    return type == input_buy || type == input_buy_ioc || type == input_buy_fok || type == input_buy_market
+               ? input_buy
+               : input_sell;
+}
+
+// limit price a market order of the given side crosses every level with
+inline uint32_t marketOrderPrice(CommandType side) {
+    return side == input_buy ? std::numeric_limits<uint32_t>::max() : 0;
+}
+
+#endif
@@ -0,0 +1,334 @@
+#include "persistence.hpp"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+namespace {
+
+constexpr char snapshot_magic[8] = {'M', 'E', 'S', 'N', 'A', 'P', '1', '\0'};
+
+struct SnapshotHeader {
+    char magic[8];
+    // first log segment not covered by the snapshot
+    uint64_t segment;
+    uint32_t num_books;
+    uint32_t reserved;
+};
+
+struct SnapshotBook {
+    char instrument[8];
+    uint64_t wal_sequence;
+    uint32_t num_orders;
+    CommandType side;
+};
+
+// one resting order, books list theirs in priority order
+struct SnapshotOrder {
+    uint32_t order_id;
+    uint32_t price;
+    uint32_t count;
+    uint32_t execution_id;
+};
+
+// Read-only mapping of a whole file, empty if it does not exist.
+struct MappedFile {
+    void* base = nullptr;
+    size_t size = 0;
+
+    explicit MappedFile(const std::string& path) {
+        int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            return;
+        }
+        struct stat st;
+        if (fstat(fd, &st) == 0 && st.st_size > 0) {
+            void* mapped = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (mapped != MAP_FAILED) {
+                base = mapped;
+                size = st.st_size;
+                madvise(base, size, MADV_SEQUENTIAL);
+            }
+        }
+        ::close(fd);
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    ~MappedFile() {
+        if (base != nullptr) {
+            munmap(base, size);
+        }
+    }
+
+    const char* data() const { return static_cast<const char*>(base); }
+};
+
+void copyName(char (&name)[9], const char (&packed)[8]) {
+    std::memcpy(name, packed, sizeof(packed));
+    name[8] = '\0';
+}
+
+bool syncDirectory(const std::string& dir) {
+    int fd = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+    bool synced = fsync(fd) == 0;
+    ::close(fd);
+    return synced;
+}
+
+// segment numbers of the wal.<n> files in dir, ascending
+std::vector<uint64_t> listSegments(const std::string& dir) {
+    std::vector<uint64_t> segments;
+    if (DIR* handle = opendir(dir.c_str())) {
+        while (dirent* entry = readdir(handle)) {
+            if (std::strncmp(entry->d_name, "wal.", 4) == 0) {
+                segments.push_back(std::strtoull(entry->d_name + 4, nullptr, 10));
+            }
+        }
+        closedir(handle);
+    }
+    std::sort(segments.begin(), segments.end());
+    return segments;
+}
+
+}  // namespace
+
+Persistence::Persistence(Options options, InstrumentDirectory& instruments, InstrumentLookup get_instrument,
+                         BookAccess with_books)
+    : options(std::move(options)),
+      instruments(instruments),
+      get_instrument(std::move(get_instrument)),
+      with_books(std::move(with_books)) {}
+
+Persistence::~Persistence() {
+    stop();
+}
+
+void Persistence::start() {
+    if (mkdir(options.dir.c_str(), 0755) != 0 && errno != EEXIST) {
+        SyncCerr() << "Failed to create persistence directory " << options.dir << std::endl;
+        return;
+    }
+    uint64_t first_segment = recover();
+    WriteAheadLog::start(WriteAheadLog::Options{
+        .dir = options.dir, .first_segment = first_segment, .flush_interval = options.wal_flush_interval});
+    started = true;
+    // drops the replayed segments, including any records past a gap that can never be applied
+    writeSnapshot();
+    snapshot_thread = std::thread(&Persistence::snapshotLoop, this);
+}
+
+void Persistence::stop() {
+    if (!started) {
+        return;
+    }
+    {
+        std::scoped_lock lock(snapshot_mut);
+        stopping = true;
+    }
+    snapshot_cv.notify_all();
+    snapshot_thread.join();
+    writeSnapshot();
+    WriteAheadLog::stop();
+    started = false;
+}
+
+uint64_t Persistence::recover() {
+    uint64_t first_segment = restoreSnapshot();
+
+    std::vector<WalRecord> records;
+    uint64_t next_segment = first_segment;
+    for (uint64_t segment : listSegments(options.dir)) {
+        if (segment < first_segment) {
+            continue;
+        }
+        replaySegment(WriteAheadLog::segmentPath(options.dir, segment), records);
+        next_segment = segment + 1;
+    }
+    applyRecords(records);
+
+    // the directory is rebuilt from what is resting, not logged
+    for (uint32_t instrument_id = 0; instrument_id < instruments.size(); ++instrument_id) {
+        InstrumentOrders& instrument_orders = instruments.get(instrument_id);
+        for (CommandType side : {input_buy, input_sell}) {
+            instrument_orders.orderbook(side).forEachOrder([&instrument_orders](const Order& order) {
+                InstrumentOrders::register_order(order.order_id, &instrument_orders);
+            });
+        }
+    }
+    return next_segment;
+}
+
+// returns the first segment not covered by the snapshot, 0 without a snapshot
+uint64_t Persistence::restoreSnapshot() {
+    MappedFile file(options.dir + "/snapshot");
+    if (file.size == 0) {
+        return 0;
+    }
+    const auto* header = reinterpret_cast<const SnapshotHeader*>(file.data());
+    if (file.size < sizeof(SnapshotHeader) || std::memcmp(header->magic, snapshot_magic, sizeof(snapshot_magic)) != 0) {
+        SyncCerr() << "Ignoring invalid snapshot in " << options.dir << std::endl;
+        return 0;
+    }
+
+    size_t offset = sizeof(SnapshotHeader);
+    for (uint32_t book_idx = 0; book_idx < header->num_books; ++book_idx) {
+        if (offset + sizeof(SnapshotBook) > file.size) {
+            break;
+        }
+        const auto* book = reinterpret_cast<const SnapshotBook*>(file.data() + offset);
+        offset += sizeof(SnapshotBook);
+        if (offset + book->num_orders * sizeof(SnapshotOrder) > file.size) {
+            break;
+        }
+        const auto* orders = reinterpret_cast<const SnapshotOrder*>(file.data() + offset);
+        offset += book->num_orders * sizeof(SnapshotOrder);
+
+        char name[9];
+        copyName(name, book->instrument);
+        OrderBook& orderbook = get_instrument(name).orderbook(book->side);
+        for (uint32_t i = 0; i < book->num_orders; ++i) {
+            orderbook.restoreOrder(orders[i].order_id, orders[i].price, orders[i].count, orders[i].execution_id);
+        }
+        orderbook.setWalSequence(book->wal_sequence);
+    }
+    return header->segment;
+}
+
+void Persistence::replaySegment(const std::string& path, std::vector<WalRecord>& records) {
+    MappedFile file(path);
+    // a torn last record from a crash is ignored
+    size_t num_records = file.size / sizeof(WalRecord);
+    const auto* begin = reinterpret_cast<const WalRecord*>(file.data());
+    records.insert(records.end(), begin, begin + num_records);
+}
+
+void Persistence::applyRecords(std::vector<WalRecord>& records) {
+    // per book, in the order the changes were made
+    std::stable_sort(records.begin(), records.end(), [](const WalRecord& a, const WalRecord& b) {
+        int by_instrument = std::memcmp(a.instrument, b.instrument, sizeof(a.instrument));
+        if (by_instrument != 0) {
+            return by_instrument < 0;
+        }
+        if (a.side != b.side) {
+            return a.side < b.side;
+        }
+        return a.book_sequence < b.book_sequence;
+    });
+
+    OrderBook* orderbook = nullptr;
+    char name[9];
+    bool gap = false;
+    for (size_t i = 0; i < records.size(); ++i) {
+        const WalRecord& record = records[i];
+        if (i == 0 || std::memcmp(record.instrument, records[i - 1].instrument, sizeof(record.instrument)) != 0 ||
+            record.side != records[i - 1].side) {
+            copyName(name, record.instrument);
+            orderbook = &get_instrument(name).orderbook(static_cast<CommandType>(record.side));
+            gap = false;
+        }
+        uint64_t expected = orderbook->walSequence() + 1;
+        if (gap || record.book_sequence < expected) {
+            continue;   // already in the snapshot, or unreachable past a gap
+        }
+        if (record.book_sequence > expected) {
+            // a record of another thread was lost in the crash, nothing after it can be applied
+            SyncCerr() << "Write-ahead log of " << name << " has a gap, dropping its tail" << std::endl;
+            gap = true;
+            continue;
+        }
+        switch (record.op) {
+            case WalOp::Rested:
+                orderbook->restoreOrder(record.order_id, record.price, record.count, 0);
+                break;
+            case WalOp::Filled:
+                orderbook->restoreFill(record.order_id, record.count);
+                break;
+            case WalOp::Removed:
+                orderbook->removeOrder(record.order_id);
+                break;
+            case WalOp::Amended:
+                orderbook->restoreAmend(record.order_id, record.price, record.count);
+                break;
+        }
+        orderbook->setWalSequence(record.book_sequence);
+    }
+}
+
+void Persistence::snapshotLoop() {
+    std::unique_lock<std::mutex> lock(snapshot_mut);
+    while (!snapshot_cv.wait_for(lock, options.snapshot_interval, [this] { return stopping; })) {
+        lock.unlock();
+        writeSnapshot();
+        lock.lock();
+    }
+}
+
+bool Persistence::writeSnapshot() {
+    uint64_t segment = WriteAheadLog::rotate();
+    std::string tmp_path = options.dir + "/snapshot.tmp";
+    FILE* file = std::fopen(tmp_path.c_str(), "wb");
+    if (file == nullptr) {
+        SyncCerr() << "Failed to write snapshot " << tmp_path << std::endl;
+        return false;
+    }
+
+    uint32_t num_instruments = instruments.size();
+    SnapshotHeader header{};
+    std::memcpy(header.magic, snapshot_magic, sizeof(header.magic));
+    header.segment = segment;
+    header.num_books = num_instruments * 2;
+    std::fwrite(&header, sizeof(header), 1, file);
+
+    std::vector<SnapshotOrder> orders;
+    for (uint32_t instrument_id = 0; instrument_id < num_instruments; ++instrument_id) {
+        InstrumentOrders& instrument_orders = instruments.get(instrument_id);
+        for (CommandType side : {input_buy, input_sell}) {
+            SnapshotBook book{};
+            std::memcpy(book.instrument, instrument_orders.name(), strnlen(instrument_orders.name(), sizeof(book.instrument)));
+            book.side = side;
+            orders.clear();
+            // the book is only held while copying, writing happens after
+            with_books(instrument_orders, [&] {
+                OrderBook& orderbook = instrument_orders.orderbook(side);
+                orderbook.forEachOrder([&orders](const Order& order) {
+                    orders.push_back(SnapshotOrder{order.order_id, order.price, order.count, order.execution_id});
+                });
+                book.wal_sequence = orderbook.walSequence();
+            });
+            book.num_orders = orders.size();
+            std::fwrite(&book, sizeof(book), 1, file);
+            std::fwrite(orders.data(), sizeof(SnapshotOrder), orders.size(), file);
+        }
+    }
+
+    bool written = std::fflush(file) == 0 && fsync(fileno(file)) == 0;
+    std::fclose(file);
+    if (!written || std::rename(tmp_path.c_str(), (options.dir + "/snapshot").c_str()) != 0 ||
+        !syncDirectory(options.dir)) {
+        SyncCerr() << "Failed to write snapshot in " << options.dir << std::endl;
+        return false;
+    }
+    deleteSegmentsBefore(segment);
+    return true;
+}
+
+void Persistence::deleteSegmentsBefore(uint64_t segment) {
+    for (uint64_t old_segment : listSegments(options.dir)) {
+        if (old_segment < segment) {
+            ::unlink(WriteAheadLog::segmentPath(options.dir, old_segment).c_str());
+        }
+    }
+}
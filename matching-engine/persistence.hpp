@@ -0,0 +1,74 @@
+#ifndef PERSISTENCE_HPP
+#define PERSISTENCE_HPP
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "instrument_directory.hpp"
+#include "instrument_orders.hpp"
+#include "write_ahead_log.hpp"
+
+// Durable book state: the write-ahead log of book changes plus periodic
+// snapshots of every book, all in one directory.
+//
+// A snapshot is taken by rotating the log to a new segment and then copying
+// each book in turn, holding only that book while copying it, so matching
+// elsewhere goes on. Once the snapshot is durable the segments before the
+// rotation are deleted. On start, the latest snapshot is mapped and its books
+// restored, then the log segments written since are replayed, so restart time
+// follows the size of the live books and the snapshot interval rather than the
+// length of the history.
+class Persistence {
+   public:
+    struct Options {
+        std::string dir;
+        std::chrono::milliseconds snapshot_interval{60000};
+        std::chrono::microseconds wal_flush_interval{1000};
+    };
+
+    // runs f with no other thread touching the books of the instrument
+    using BookAccess = std::function<void(InstrumentOrders&, const std::function<void()>& f)>;
+    // finds or creates an instrument the way the engine does
+    using InstrumentLookup = std::function<InstrumentOrders&(const char* instrument)>;
+
+    Persistence(Options options, InstrumentDirectory& instruments, InstrumentLookup get_instrument, BookAccess with_books);
+    Persistence(const Persistence&) = delete;
+    Persistence& operator=(const Persistence&) = delete;
+    ~Persistence();
+
+    // Restores the books from the directory, then starts the log and snapshots.
+    // Must run before any command is processed.
+    void start();
+    // Stops snapshots, writes a final one and syncs the log. Must run after the
+    // last command was processed.
+    void stop();
+
+   private:
+    Options options;
+    InstrumentDirectory& instruments;
+    InstrumentLookup get_instrument;
+    BookAccess with_books;
+
+    std::thread snapshot_thread;
+    std::mutex snapshot_mut;
+    std::condition_variable snapshot_cv;
+    bool stopping = false;
+    bool started = false;
+
+    // returns the first log segment to write to
+    uint64_t recover();
+    uint64_t restoreSnapshot();
+    void replaySegment(const std::string& path, std::vector<WalRecord>& records);
+    void applyRecords(std::vector<WalRecord>& records);
+
+    void snapshotLoop();
+    bool writeSnapshot();
+    void deleteSegmentsBefore(uint64_t segment);
+};
+
+#endif
@@ -0,0 +1,180 @@
+#include "placement.hpp"
+
+#include <dirent.h>
+#include <sched.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <string>
+
+namespace {
+
+// "0-3,8,10-11" as written by the kernel to cpulist files
+std::vector<int> parseCpuRanges(const std::string& ranges) {
+    std::vector<int> cpus;
+    std::stringstream stream(ranges);
+    std::string range;
+    while (std::getline(stream, range, ',')) {
+        if (range.empty() || range == "\n") {
+            continue;
+        }
+        int first = std::atoi(range.c_str());
+        size_t dash = range.find('-');
+        int last = dash == std::string::npos ? first : std::atoi(range.c_str() + dash + 1);
+        for (int cpu = first; cpu <= last; ++cpu) {
+            cpus.push_back(cpu);
+        }
+    }
+    return cpus;
+}
+
+std::string readLine(const std::string& path) {
+    std::ifstream file(path);
+    std::string line;
+    std::getline(file, line);
+    return line;
+}
+
+// the first hardware thread of its core
+bool isPrimaryThread(const std::string& sysfs_root, int cpu) {
+    std::vector<int> siblings =
+        parseCpuRanges(readLine(sysfs_root + "/cpu/cpu" + std::to_string(cpu) + "/topology/thread_siblings_list"));
+    return siblings.empty() || siblings.front() == cpu;
+}
+
+}  // namespace
+
+CpuTopology CpuTopology::detect(const std::string& sysfs_root) {
+    CpuTopology topology;
+    topology.sysfs_root = sysfs_root;
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+        return topology;
+    }
+
+    if (DIR* dir = opendir((sysfs_root + "/node").c_str())) {
+        std::vector<int> node_ids;
+        while (dirent* entry = readdir(dir)) {
+            if (std::strncmp(entry->d_name, "node", 4) == 0 && entry->d_name[4] >= '0' && entry->d_name[4] <= '9') {
+                node_ids.push_back(std::atoi(entry->d_name + 4));
+            }
+        }
+        closedir(dir);
+        std::sort(node_ids.begin(), node_ids.end());
+        for (int node_id : node_ids) {
+            std::vector<int> cpus =
+                parseCpuRanges(readLine(sysfs_root + "/node/node" + std::to_string(node_id) + "/cpulist"));
+            std::erase_if(cpus, [&](int cpu) { return cpu >= CPU_SETSIZE || !CPU_ISSET(cpu, &allowed); });
+            if (!cpus.empty()) {
+                topology.nodes.push_back(std::move(cpus));
+            }
+        }
+    }
+    if (topology.nodes.empty()) {
+        std::vector<int> cpus;
+        for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+            if (CPU_ISSET(cpu, &allowed)) {
+                cpus.push_back(cpu);
+            }
+        }
+        topology.nodes.push_back(std::move(cpus));
+    }
+    return topology;
+}
+
+int CpuTopology::nodeOf(int cpu) const {
+    for (size_t node = 0; node < nodes.size(); ++node) {
+        if (std::binary_search(nodes[node].begin(), nodes[node].end(), cpu)) {
+            return static_cast<int>(node);
+        }
+    }
+    return -1;
+}
+
+std::vector<int> CpuTopology::spread(size_t n) const {
+    std::vector<std::vector<int>> ordered;
+    for (const std::vector<int>& cpus : nodes) {
+        std::vector<int> node_cpus = cpus;
+        std::stable_partition(node_cpus.begin(), node_cpus.end(),
+                              [&](int cpu) { return isPrimaryThread(sysfs_root, cpu); });
+        ordered.push_back(std::move(node_cpus));
+    }
+
+    std::vector<int> chosen;
+    for (size_t round = 0; chosen.size() < n; ++round) {
+        bool any = false;
+        for (const std::vector<int>& node_cpus : ordered) {
+            if (round < node_cpus.size() && chosen.size() < n) {
+                chosen.push_back(node_cpus[round]);
+                any = true;
+            }
+        }
+        if (!any) {
+            break;
+        }
+    }
+    return chosen;
+}
+
+InstrumentPlacement::InstrumentPlacement(std::vector<int> matcher_nodes)
+    : matcher_nodes(std::move(matcher_nodes)), instruments_per_matcher(this->matcher_nodes.size(), 0) {}
+
+uint32_t InstrumentPlacement::assign() {
+    auto fewest = std::min_element(instruments_per_matcher.begin(), instruments_per_matcher.end());
+    ++*fewest;
+    return static_cast<uint32_t>(fewest - instruments_per_matcher.begin());
+}
+
+std::optional<InstrumentPlacement::Move> InstrumentPlacement::plan(const std::vector<uint64_t>& loads,
+                                                                   const std::vector<uint32_t>& owners,
+                                                                   double imbalance) {
+    std::vector<uint64_t> matcher_loads(matcher_nodes.size(), 0);
+    for (size_t instrument_id = 0; instrument_id < loads.size(); ++instrument_id) {
+        matcher_loads[owners[instrument_id]] += loads[instrument_id];
+    }
+    auto overloaded = [&](uint32_t busy, uint32_t idle) {
+        return static_cast<double>(matcher_loads[busy]) > (1 + imbalance) * static_cast<double>(matcher_loads[idle]);
+    };
+
+    uint32_t busiest = static_cast<uint32_t>(std::max_element(matcher_loads.begin(), matcher_loads.end()) - matcher_loads.begin());
+    uint32_t idlest = static_cast<uint32_t>(std::min_element(matcher_loads.begin(), matcher_loads.end()) - matcher_loads.begin());
+    if (!overloaded(busiest, idlest)) {
+        return std::nullopt;
+    }
+    // staying on the node keeps the instrument next to the memory it was allocated in
+    std::optional<uint32_t> local_idlest;
+    for (uint32_t matcher = 0; matcher < matcher_nodes.size(); ++matcher) {
+        if (matcher != busiest && matcher_nodes[matcher] == matcher_nodes[busiest] &&
+            (!local_idlest || matcher_loads[matcher] < matcher_loads[*local_idlest])) {
+            local_idlest = matcher;
+        }
+    }
+    uint32_t target = local_idlest && overloaded(busiest, *local_idlest) ? *local_idlest : idlest;
+
+    // the instrument closest to half the gap evens the two out best; one carrying
+    // the whole gap or more would only swap which matcher is overloaded
+    uint64_t gap = matcher_loads[busiest] - matcher_loads[target];
+    std::optional<Move> best;
+    uint64_t best_distance = 0;
+    for (size_t instrument_id = 0; instrument_id < loads.size(); ++instrument_id) {
+        uint64_t load = loads[instrument_id];
+        if (owners[instrument_id] != busiest || load == 0 || load >= gap) {
+            continue;
+        }
+        uint64_t distance = load * 2 > gap ? load * 2 - gap : gap - load * 2;
+        if (!best || distance < best_distance) {
+            best = Move{static_cast<uint32_t>(instrument_id), busiest, target};
+            best_distance = distance;
+        }
+    }
+    return best;
+}
+
+void InstrumentPlacement::moved(const Move& move) {
+    --instruments_per_matcher[move.from];
+    ++instruments_per_matcher[move.to];
+}
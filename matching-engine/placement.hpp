@@ -0,0 +1,59 @@
+#ifndef PLACEMENT_HPP
+#define PLACEMENT_HPP
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <vector>
+
+// CPUs this process may run on, grouped by NUMA node, read from sysfs.
+struct CpuTopology {
+    // allowed cpus of each node, ascending; one node holding every allowed cpu
+    // when the kernel exposes no NUMA information
+    std::vector<std::vector<int>> nodes;
+    // where detect() read the nodes from; spread() reads SMT siblings there too
+    std::string sysfs_root = default_sysfs_root;
+
+    static constexpr const char* default_sysfs_root = "/sys/devices/system";
+
+    // sysfs_root may point at a copy of another machine's tree, e.g. in tests
+    static CpuTopology detect(const std::string& sysfs_root = default_sysfs_root);
+
+    // -1 if cpu is not allowed
+    int nodeOf(int cpu) const;
+
+    // n distinct cpus dealt round robin over the nodes, whole cores before their
+    // SMT siblings; fewer than n if fewer cpus are allowed
+    std::vector<int> spread(size_t n) const;
+};
+
+// Decides which matcher owns which instrument in single-writer mode.
+// Not thread safe, callers serialise assign() and plan().
+class InstrumentPlacement {
+    // node of each matcher, -1 if it is not pinned
+    std::vector<int> matcher_nodes;
+    std::vector<uint32_t> instruments_per_matcher;
+
+   public:
+    struct Move {
+        uint32_t instrument_id;
+        uint32_t from;
+        uint32_t to;
+    };
+
+    explicit InstrumentPlacement(std::vector<int> matcher_nodes);
+
+    // matcher for a new instrument, the one owning the fewest instruments
+    uint32_t assign();
+
+    // Given the load of every instrument since the last call (commands matched) and
+    // the matcher owning it, the move of one instrument off the busiest matcher that
+    // best evens it out with the idlest one, preferring an idlest matcher on the same
+    // node. Nothing while the busiest matcher is within imbalance of the idlest one.
+    std::optional<Move> plan(const std::vector<uint64_t>& loads, const std::vector<uint32_t>& owners,
+                             double imbalance);
+    // records a move plan() proposed once it was carried out
+    void moved(const Move& move);
+};
+
+#endif
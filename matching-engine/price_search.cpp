@@ -0,0 +1,135 @@
+#include "price_search.hpp"
+
+#include <bit>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define PRICE_SEARCH_HAS_AVX2 1
+#else
+#define PRICE_SEARCH_HAS_AVX2 0
+#endif
+
+namespace {
+
+// Ladders up to this many levels are scanned from the back, which ends within the
+// first few levels for most searches. Deeper ones are first narrowed down by a
+// binary search to a window of at most this many levels, and the window scanned:
+// scanning a fixed number of levels ahead of the binary search made random
+// searches on deep ladders slower than a plain lower_bound.
+constexpr size_t scalar_max_scan = 8;
+constexpr size_t avx2_max_scan = 64;
+
+// Binary search without data dependent branches until at most window prices are
+// left; returns the start of those. Every price at or after the end of the window
+// satisfies, the boundary may be anywhere within it.
+template <typename Satisfies>
+size_t narrowTo(const uint32_t* prices, size_t& len, size_t window, Satisfies satisfies) {
+    const uint32_t* first = prices;
+    while (len > window) {
+        size_t half = len / 2;
+        first = satisfies(first[half - 1]) ? first : first + half;
+        len -= half;
+    }
+    return first - prices;
+}
+
+template <typename Satisfies>
+size_t scalarScan(const uint32_t* prices, size_t n, Satisfies satisfies) {
+    size_t scanned = 0;
+    while (scanned < n && satisfies(prices[n - 1 - scanned])) {
+        ++scanned;
+    }
+    return scanned;
+}
+
+template <typename Satisfies>
+size_t scalarSuffix(const uint32_t* prices, size_t n, Satisfies satisfies) {
+    size_t window = n;
+    size_t first = narrowTo(prices, window, scalar_max_scan, satisfies);
+    return n - first - window + scalarScan(prices + first, window, satisfies);
+}
+
+size_t scalarAtLeast(const uint32_t* prices, size_t n, uint32_t bound) {
+    return scalarSuffix(prices, n, [bound](uint32_t price) { return price >= bound; });
+}
+
+size_t scalarAtMost(const uint32_t* prices, size_t n, uint32_t bound) {
+    return scalarSuffix(prices, n, [bound](uint32_t price) { return price <= bound; });
+}
+
+#if PRICE_SEARCH_HAS_AVX2
+
+// 8 prices at a time from the back; the array is sorted, so the satisfying lanes
+// of a block are always its top lanes and their count is the popcount
+template <bool AtLeast>
+__attribute__((target("avx2"))) size_t avx2Scan(const uint32_t* prices, size_t n, uint32_t bound) {
+    const __m256i bounds = _mm256_set1_epi32(static_cast<int>(bound));
+    size_t scanned = 0;
+    while (n - scanned >= 8) {
+        __m256i block = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(prices + n - scanned - 8));
+        // unsigned compare: price >= bound iff max(price, bound) == price
+        __m256i extreme = AtLeast ? _mm256_max_epu32(block, bounds) : _mm256_min_epu32(block, bounds);
+        unsigned mask = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(extreme, block)));
+        if (mask != 0xff) {
+            return scanned + std::popcount(mask);
+        }
+        scanned += 8;
+    }
+    // fewer than 8 prices left
+    auto satisfies = [bound](uint32_t price) { return AtLeast ? price >= bound : price <= bound; };
+    return scanned + scalarScan(prices, n - scanned, satisfies);
+}
+
+template <bool AtLeast>
+size_t avx2Suffix(const uint32_t* prices, size_t n, uint32_t bound) {
+    auto satisfies = [bound](uint32_t price) { return AtLeast ? price >= bound : price <= bound; };
+    size_t window = n;
+    size_t first = narrowTo(prices, window, avx2_max_scan, satisfies);
+    return n - first - window + avx2Scan<AtLeast>(prices + first, window, bound);
+}
+
+size_t avx2AtLeast(const uint32_t* prices, size_t n, uint32_t bound) {
+    return avx2Suffix<true>(prices, n, bound);
+}
+
+size_t avx2AtMost(const uint32_t* prices, size_t n, uint32_t bound) {
+    return avx2Suffix<false>(prices, n, bound);
+}
+
+#endif
+
+}  // namespace
+
+bool PriceSearch::avx2Supported() {
+#if PRICE_SEARCH_HAS_AVX2
+    // may run during static initialisation, before the CPU model is set up otherwise
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+#else
+    return false;
+#endif
+}
+
+void PriceSearch::select(bool avx2) {
+#if PRICE_SEARCH_HAS_AVX2
+    if (avx2 && avx2Supported()) {
+        at_least = avx2AtLeast;
+        at_most = avx2AtMost;
+        avx2_selected = true;
+        return;
+    }
+#endif
+    at_least = scalarAtLeast;
+    at_most = scalarAtMost;
+    avx2_selected = false;
+}
+
+#if PRICE_SEARCH_HAS_AVX2
+PriceSearch::Kernel PriceSearch::at_least = PriceSearch::avx2Supported() ? avx2AtLeast : scalarAtLeast;
+PriceSearch::Kernel PriceSearch::at_most = PriceSearch::avx2Supported() ? avx2AtMost : scalarAtMost;
+bool PriceSearch::avx2_selected = PriceSearch::avx2Supported();
+#else
+PriceSearch::Kernel PriceSearch::at_least = scalarAtLeast;
+PriceSearch::Kernel PriceSearch::at_most = scalarAtMost;
+bool PriceSearch::avx2_selected = false;
+#endif
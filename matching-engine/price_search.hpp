@@ -0,0 +1,40 @@
+#ifndef PRICE_SEARCH_HPP
+#define PRICE_SEARCH_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+// Searches over a price ladder stored as a contiguous array of prices.
+//
+// Both kernels return the length of the suffix of prices that satisfies a bound:
+// suffixAtLeast for ascending arrays (prices >= bound), suffixAtMost for
+// descending ones (prices <= bound). With the best level at the back, that is
+// how many levels an incoming price crosses, and n minus it is where a level for
+// the price belongs. The suffix is usually short, so short ladders are scanned
+// from the back, eight prices per compare with AVX2; deep ladders are narrowed
+// down by a branchless binary search first and only the last window is scanned.
+// The AVX2 kernels are picked at startup when the CPU has AVX2.
+class PriceSearch {
+   public:
+    using Kernel = size_t (*)(const uint32_t* prices, size_t n, uint32_t bound);
+
+    static size_t suffixAtLeast(const uint32_t* prices, size_t n, uint32_t bound) {
+        return at_least(prices, n, bound);
+    }
+    static size_t suffixAtMost(const uint32_t* prices, size_t n, uint32_t bound) {
+        return at_most(prices, n, bound);
+    }
+
+    static bool avx2Supported();
+    // switches to the AVX2 or scalar kernels, e.g. to compare them; AVX2 is
+    // ignored where unsupported. Not meant to be called while books are in use.
+    static void select(bool avx2);
+    static bool avx2Selected() { return avx2_selected; }
+
+   private:
+    static Kernel at_least;
+    static Kernel at_most;
+    static bool avx2_selected;
+};
+
+#endif
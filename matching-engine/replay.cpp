@@ -0,0 +1,64 @@
+#include "replay.hpp"
+
+#include <chrono>
+
+#include "instrument_orders.hpp"
+
+Replay::Replay(size_t max_instruments) : instruments(max_instruments) {}
+
+ReplayStats Replay::run(std::span<const ClientCommand> commands, FILE* events_out) {
+    this->events_out = events_out;
+    num_events = 0;
+    EventJournal::redirect(on_event, this);
+
+    auto start = std::chrono::steady_clock::now();
+    for (command_idx = 0; command_idx < commands.size(); ++command_idx) {
+        // matching consumes the count, the mapping stays read-only
+        ClientCommand command = commands[command_idx];
+        process(command);
+        if (formatted.size() >= 1 << 16) {
+            flush();
+        }
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    EventJournal::redirect(nullptr, nullptr);
+    flush();
+    return ReplayStats{commands.size(), num_events, seconds};
+}
+
+// the same steps as Engine::route_command and the matcher, on one thread
+void Replay::process(ClientCommand& command) {
+    InstrumentOrders* instrument_orders;
+    if (targetsRestingOrder(command.type)) {
+        instrument_orders = InstrumentOrders::find_order(command.order_id);
+        if (instrument_orders == nullptr) {
+            InstrumentOrders::reject_unknown_order(command.order_id);
+            return;
+        }
+    } else {
+        instrument_orders = &instruments.getOrCreate(command.instrument, [](InstrumentOrders&) {});
+        if (InstrumentOrders::may_rest(command)) {
+            InstrumentOrders::register_order(command.order_id, instrument_orders);
+        }
+    }
+    instrument_orders->process_command_unlocked(command);
+}
+
+void Replay::flush() {
+    if (events_out != nullptr && !formatted.empty()) {
+        std::fwrite(formatted.data(), 1, formatted.size(), events_out);
+    }
+    formatted.clear();
+}
+
+void Replay::on_event(const EventRecord& record, void* context) {
+    Replay& replay = *static_cast<Replay*>(context);
+    ++replay.num_events;
+    if (replay.events_out == nullptr) {
+        return;
+    }
+    EventRecord canonical = record;
+    canonical.timestamp = static_cast<intmax_t>(replay.command_idx);
+    EventJournal::format(replay.formatted, canonical);
+}
@@ -0,0 +1,49 @@
+#ifndef REPLAY_HPP
+#define REPLAY_HPP
+
+#include <cstdint>
+#include <cstdio>
+#include <span>
+#include <string>
+
+#include "event_journal.hpp"
+#include "instrument_directory.hpp"
+#include "io.hpp"
+
+struct ReplayStats {
+    uint64_t commands = 0;
+    uint64_t events = 0;
+    double seconds = 0;
+};
+
+// Feeds captured commands through InstrumentOrders on the calling thread, with
+// no locks, sockets or matcher threads, in capture order.
+//
+// Events go out as a canonical stream: Output's format with the timestamp
+// replaced by the index of the command in the capture that caused the event.
+// Matching is deterministic given the command order, so two runs or two builds
+// over the same capture produce the same bytes unless matching changed.
+//
+// Uses the process-wide order directory and takes over EventJournal output while
+// running, so nothing else may run an Engine in the process at the same time.
+class Replay {
+    InstrumentDirectory instruments;
+
+    FILE* events_out = nullptr;
+    std::string formatted;
+    uint64_t command_idx = 0;
+    uint64_t num_events = 0;
+
+   public:
+    explicit Replay(size_t max_instruments = 1 << 16);
+
+    // events_out may be nullptr to only measure matching
+    ReplayStats run(std::span<const ClientCommand> commands, FILE* events_out);
+
+   private:
+    void process(ClientCommand& command);
+    void flush();
+    static void on_event(const EventRecord& record, void* context);
+};
+
+#endif
@@ -0,0 +1,53 @@
+#ifndef SPSC_RING_HPP
+#define SPSC_RING_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+
+// Bounded lock-free single-producer single-consumer ring.
+template <typename T>
+class SpscRing {
+    std::unique_ptr<T[]> items;
+    size_t mask;
+
+    // written by the consumer only
+    alignas(64) std::atomic<size_t> head{0};
+    // written by the producer only
+    alignas(64) std::atomic<size_t> tail{0};
+
+   public:
+    // capacity must be a power of two
+    explicit SpscRing(size_t capacity) : items(new T[capacity]), mask(capacity - 1) {}
+
+    SpscRing(const SpscRing&) = delete;
+    SpscRing& operator=(const SpscRing&) = delete;
+
+    // returns false if the ring is full
+    bool tryPush(const T& item) {
+        size_t current_tail = tail.load(std::memory_order_relaxed);
+        if (current_tail - head.load(std::memory_order_acquire) > mask) {
+            return false;
+        }
+        items[current_tail & mask] = item;
+        tail.store(current_tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    // returns false if the ring is empty
+    bool tryPop(T& item) {
+        size_t current_head = head.load(std::memory_order_relaxed);
+        if (current_head == tail.load(std::memory_order_acquire)) {
+            return false;
+        }
+        item = items[current_head & mask];
+        head.store(current_head + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool empty() const {
+        return head.load(std::memory_order_acquire) == tail.load(std::memory_order_acquire);
+    }
+};
+
+#endif
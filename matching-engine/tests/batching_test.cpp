@@ -0,0 +1,155 @@
+// Checks that matching runs of same-instrument commands as a batch changes
+// nothing in the output: one client's command flow is handed to the engine one
+// command at a time, then in reads of up to 64 commands, which the engine splits
+// into batches per instrument, and the events, timestamps aside, must be the
+// same. The flow mixes every command type, including cancels and amends of
+// orders in the same read. Single-writer mode with one matcher must produce the
+// same events as well. Exits non-zero on a difference.
+//
+// Built and run from matching-engine/ by `make test`.
+
+#include <cstdio>
+#include <mutex>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "engine.hpp"
+#include "hot_path_stats.hpp"
+#include "order_types.hpp"
+
+namespace {
+
+constexpr uint32_t num_commands = 30000;
+// order ids of every run start here, the order directory is shared by all runs
+constexpr uint32_t ids_per_run = 1000000;
+
+struct Run {
+    const char* name;
+    EngineConfig::Mode mode;
+    size_t max_read;
+};
+
+// commands in runs of one instrument, ids counted from 1
+std::vector<ClientCommand> makeFlow() {
+    std::mt19937 rng(3);
+    const CommandType orders[] = {input_buy,     input_sell,     input_buy,        input_sell,       input_buy_ioc,
+                                  input_sell_ioc, input_buy_fok, input_sell_fok,   input_buy_market, input_sell_market};
+    std::vector<ClientCommand> flow;
+    uint32_t next_id = 1;
+    while (flow.size() < num_commands) {
+        char instrument[9];
+        std::snprintf(instrument, sizeof(instrument), "SYM%u", static_cast<unsigned>(rng() % 3));
+        for (uint32_t in_run = 1 + rng() % 30; in_run > 0; --in_run) {
+            ClientCommand command{};
+            std::snprintf(command.instrument, sizeof(command.instrument), "%s", instrument);
+            command.price = 95 + rng() % 11;
+            command.count = rng() % 20 == 0 ? 0 : 1 + rng() % 10;
+            uint32_t kind = rng() % 100;
+            if (kind < 15 && next_id > 1) {
+                command.type = input_cancel;
+                command.order_id = next_id - 1 - rng() % std::min<uint32_t>(next_id - 1, 20);
+            } else if (kind < 20 && next_id > 1) {
+                command.type = input_amend;
+                command.order_id = next_id - 1 - rng() % std::min<uint32_t>(next_id - 1, 20);
+            } else {
+                command.type = orders[rng() % std::size(orders)];
+                command.order_id = next_id++;
+            }
+            flow.push_back(command);
+        }
+    }
+    return flow;
+}
+
+void collect(const EventRecord& record, void* context) {
+    static std::mutex mut;
+    std::scoped_lock lock(mut);
+    static_cast<std::vector<EventRecord>*>(context)->push_back(record);
+}
+
+uint64_t batchesSoFar() {
+    return HotPathStats::snapshot().totals[static_cast<size_t>(HotPathCounter::Batches)];
+}
+
+// the events as output lines, with the run's id offset and timestamps removed
+std::vector<std::string> runFlow(const Run& run, std::vector<ClientCommand> flow, uint32_t id_offset,
+                                 uint64_t& batches) {
+    for (ClientCommand& command : flow) {
+        command.order_id += id_offset;
+    }
+    std::vector<EventRecord> events;
+    uint64_t batches_before = batchesSoFar();
+    EventJournal::redirect(collect, &events);
+    {
+        EngineConfig config;
+        config.mode = run.mode;
+        Engine engine(config);
+        ClientState client;
+        std::mt19937 rng(5);
+        for (size_t start = 0; start < flow.size();) {
+            size_t read = std::min<size_t>(1 + rng() % run.max_read, flow.size() - start);
+            engine.submit(std::span(flow).subspan(start, read), client);
+            start += read;
+        }
+        engine.drain();
+    }
+    EventJournal::redirect(nullptr, nullptr);
+    batches = batchesSoFar() - batches_before;
+
+    std::vector<std::string> lines;
+    for (EventRecord& record : events) {
+        record.timestamp = 0;
+        record.order_id -= id_offset;
+        if (record.type == EventType::OrderExecuted) {
+            record.active_order_id -= id_offset;
+        }
+        std::string line;
+        EventJournal::format(line, record);
+        lines.push_back(std::move(line));
+    }
+    return lines;
+}
+
+}  // namespace
+
+int main() {
+    std::vector<ClientCommand> flow = makeFlow();
+    const Run runs[] = {
+        {"locked, one command per read", EngineConfig::Mode::Locked, 1},
+        {"locked, batched reads", EngineConfig::Mode::Locked, 64},
+        {"single writer, batched reads", EngineConfig::Mode::SingleWriter, 64},
+    };
+
+    std::vector<std::string> expected;
+    bool ok = true;
+    for (uint32_t i = 0; i < std::size(runs); ++i) {
+        uint64_t batches = 0;
+        std::vector<std::string> lines = runFlow(runs[i], flow, i * ids_per_run, batches);
+        if (i == 0) {
+            expected = std::move(lines);
+            std::fprintf(stderr, "%s: %zu events\n", runs[i].name, expected.size());
+            continue;
+        }
+        // single-writer matchers take commands one by one
+        if (runs[i].mode == EngineConfig::Mode::Locked && batches == 0) {
+            std::fprintf(stderr, "%s: no batches were matched\n", runs[i].name);
+            ok = false;
+        }
+        size_t first_difference = 0;
+        while (first_difference < std::min(lines.size(), expected.size()) &&
+               lines[first_difference] == expected[first_difference]) {
+            ++first_difference;
+        }
+        bool same = lines.size() == expected.size() && first_difference == lines.size();
+        std::fprintf(stderr, "%s: %zu events in %llu batches, %s\n", runs[i].name, lines.size(),
+                     static_cast<unsigned long long>(batches), same ? "same as unbatched" : "DIFFERENT");
+        if (!same) {
+            std::fprintf(stderr, "  first difference at event %zu: %s  expected: %s", first_difference,
+                         first_difference < lines.size() ? lines[first_difference].c_str() : "(none)\n",
+                         first_difference < expected.size() ? expected[first_difference].c_str() : "(none)\n");
+            ok = false;
+        }
+    }
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,165 @@
+// Checks that a command capture replays to the events the engine printed: one
+// client's mixed flow runs through an engine capturing to a file, the capture
+// must hold exactly the commands sent, and replaying it must produce the same
+// events, timestamps aside, in the same order. Exits non-zero on a difference.
+//
+// Built and run from matching-engine/ by `make test`.
+
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "command_capture.hpp"
+#include "engine.hpp"
+#include "order_types.hpp"
+#include "replay.hpp"
+
+namespace {
+
+constexpr uint32_t num_commands = 20000;
+// the engine run uses ids from here, and the replay the same ids counted from
+// 1, so that the two never meet in the process-wide order directory
+constexpr uint32_t engine_id_offset = 1000000;
+
+std::vector<ClientCommand> makeFlow() {
+    std::mt19937 rng(11);
+    const CommandType orders[] = {input_buy,     input_sell,     input_buy,        input_sell,       input_buy_ioc,
+                                  input_sell_ioc, input_buy_fok, input_sell_fok,   input_buy_market, input_sell_market};
+    std::vector<ClientCommand> flow;
+    uint32_t next_id = engine_id_offset + 1;
+    while (flow.size() < num_commands) {
+        ClientCommand command{};
+        std::snprintf(command.instrument, sizeof(command.instrument), "CAP%u", static_cast<unsigned>(rng() % 3));
+        command.price = 95 + rng() % 11;
+        command.count = rng() % 20 == 0 ? 0 : 1 + rng() % 10;
+        uint32_t kind = rng() % 100;
+        if (kind < 20) {
+            command.type = kind < 15 ? input_cancel : input_amend;
+            // mostly recent orders, sometimes one that never existed
+            command.order_id = next_id - 1 - rng() % 20;
+        } else {
+            command.type = orders[rng() % std::size(orders)];
+            command.order_id = next_id++;
+        }
+        flow.push_back(command);
+    }
+    return flow;
+}
+
+bool sameCommand(const ClientCommand& a, const ClientCommand& b) {
+    return a.type == b.type && a.order_id == b.order_id && a.price == b.price && a.count == b.count &&
+           std::strncmp(a.instrument, b.instrument, sizeof(a.instrument)) == 0;
+}
+
+void collect(const EventRecord& record, void* context) {
+    static std::mutex mut;
+    std::scoped_lock lock(mut);
+    static_cast<std::vector<EventRecord>*>(context)->push_back(record);
+}
+
+// drops the trailing timestamp, which the replay replaces by the command index
+std::string withoutTimestamp(const std::string& line) {
+    return line.substr(0, line.rfind(' '));
+}
+
+std::vector<std::string> runEngine(std::vector<ClientCommand> flow, const std::string& capture_path) {
+    std::vector<EventRecord> events;
+    EventJournal::redirect(collect, &events);
+    {
+        EngineConfig config;
+        config.capture_path = capture_path;
+        Engine engine(config);
+        ClientState client;
+        std::mt19937 rng(13);
+        for (size_t start = 0; start < flow.size();) {
+            size_t read = std::min<size_t>(1 + rng() % 32, flow.size() - start);
+            engine.submit(std::span(flow).subspan(start, read), client);
+            start += read;
+        }
+        engine.drain();
+    }
+    EventJournal::redirect(nullptr, nullptr);
+
+    std::vector<std::string> lines;
+    for (EventRecord& record : events) {
+        record.order_id -= engine_id_offset;
+        if (record.type == EventType::OrderExecuted) {
+            record.active_order_id -= engine_id_offset;
+        }
+        std::string line;
+        EventJournal::format(line, record);
+        lines.push_back(withoutTimestamp(line));
+    }
+    return lines;
+}
+
+std::vector<std::string> runReplay(std::span<const ClientCommand> captured) {
+    std::vector<ClientCommand> commands(captured.begin(), captured.end());
+    for (ClientCommand& command : commands) {
+        command.order_id -= engine_id_offset;
+    }
+
+    std::vector<std::string> lines;
+    FILE* events_out = std::tmpfile();
+    if (events_out == nullptr) {
+        std::fprintf(stderr, "cannot create a temporary file for the replay\n");
+        return lines;
+    }
+    Replay replay;
+    replay.run(commands, events_out);
+    std::rewind(events_out);
+    char line[256];
+    while (std::fgets(line, sizeof(line), events_out) != nullptr) {
+        lines.push_back(withoutTimestamp(line));
+    }
+    std::fclose(events_out);
+    return lines;
+}
+
+}  // namespace
+
+int main() {
+    std::vector<ClientCommand> flow = makeFlow();
+    std::string capture_path = "/tmp/capture_replay_test." + std::to_string(getpid());
+    std::vector<std::string> engine_lines = runEngine(flow, capture_path);
+
+    CaptureFile capture;
+    if (!capture.open(capture_path)) {
+        std::remove(capture_path.c_str());
+        return 1;
+    }
+    std::remove(capture_path.c_str());
+
+    std::span<const ClientCommand> captured = capture.commands();
+    size_t same_commands = 0;
+    while (same_commands < std::min(captured.size(), flow.size()) &&
+           sameCommand(captured[same_commands], flow[same_commands])) {
+        ++same_commands;
+    }
+    if (captured.size() != flow.size() || same_commands != flow.size()) {
+        std::fprintf(stderr, "capture holds %zu commands, the first %zu of the %zu sent\n", captured.size(),
+                     same_commands, flow.size());
+        return 1;
+    }
+
+    std::vector<std::string> replay_lines = runReplay(captured);
+    size_t first_difference = 0;
+    while (first_difference < std::min(engine_lines.size(), replay_lines.size()) &&
+           engine_lines[first_difference] == replay_lines[first_difference]) {
+        ++first_difference;
+    }
+    bool same = engine_lines.size() == replay_lines.size() && first_difference == engine_lines.size();
+    std::fprintf(stderr, "%zu commands captured, engine %zu events, replay %zu events, %s\n", captured.size(),
+                 engine_lines.size(), replay_lines.size(), same ? "same" : "DIFFERENT");
+    if (!same) {
+        std::fprintf(stderr, "  first difference at event %zu: replay %s, engine %s\n", first_difference,
+                     first_difference < replay_lines.size() ? replay_lines[first_difference].c_str() : "(none)",
+                     first_difference < engine_lines.size() ? engine_lines[first_difference].c_str() : "(none)");
+    }
+    return same ? 0 : 1;
+}
@@ -0,0 +1,100 @@
+// Checks that async output keeps events in causal order: several clients trade
+// one instrument, and no OrderExecuted may be printed before the OrderAdded of
+// the resting order it fills. Run once per timestamp source, since coarse
+// clocks tie and per-thread clocks can disagree. Exits non-zero on a violation.
+//
+// Built and run from matching-engine/ by `make test`.
+
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+
+#include "engine.hpp"
+
+namespace {
+
+constexpr uint32_t num_clients = 4;
+constexpr uint32_t commands_per_client = 50000;
+
+void runClients(Engine& engine) {
+    std::vector<std::thread> clients;
+    for (uint32_t client = 0; client < num_clients; ++client) {
+        clients.emplace_back([&engine, client] {
+            std::mt19937 rng(client + 1);
+            ClientState state;
+            for (uint32_t i = 0; i < commands_per_client; ++i) {
+                ClientCommand command{};
+                command.type = rng() % 2 ? input_buy : input_sell;
+                command.order_id = client * commands_per_client + i + 1;
+                command.price = 1000 + rng() % 10;
+                command.count = 1 + rng() % 10;
+                std::strcpy(command.instrument, "SYM");
+                engine.submit(std::span(&command, 1), state);
+            }
+        });
+    }
+    for (std::thread& client : clients) {
+        client.join();
+    }
+}
+
+// number of executions printed before the add of their resting order
+size_t countViolations(const std::string& path) {
+    std::ifstream in(path);
+    std::unordered_set<uint32_t> added;
+    size_t violations = 0;
+    std::string line;
+    while (std::getline(in, line)) {
+        std::istringstream fields(line);
+        char type;
+        uint32_t order_id;
+        fields >> type >> order_id;
+        if (type == 'B' || type == 'S') {
+            added.insert(order_id);
+        } else if (type == 'E' && !added.count(order_id)) {
+            ++violations;
+        }
+    }
+    return violations;
+}
+
+}  // namespace
+
+int main() {
+    bool ok = true;
+    for (TimestampSource source : {TimestampSource::SteadyClock, TimestampSource::CoarseClock}) {
+        std::string path = "/tmp/event_order_test." + std::to_string(getpid());
+        std::fflush(stdout);
+        int saved_stdout = dup(STDOUT_FILENO);
+        if (std::freopen(path.c_str(), "w", stdout) == nullptr) {
+            std::fprintf(stderr, "cannot redirect output to %s\n", path.c_str());
+            return 1;
+        }
+        {
+            EngineConfig config;
+            config.async_output = true;
+            config.timestamp_source = source;
+            Engine engine(config);
+            runClients(engine);
+            engine.drain();
+        }
+        std::fflush(stdout);
+        dup2(saved_stdout, STDOUT_FILENO);
+        close(saved_stdout);
+
+        size_t violations = countViolations(path);
+        std::remove(path.c_str());
+        std::fprintf(stderr, "%s clock: %zu executions before their resting order's add\n",
+                     source == TimestampSource::SteadyClock ? "steady" : "coarse", violations);
+        ok &= violations == 0;
+    }
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,110 @@
+// Checks that the I/O worker pool hands over every command of every session, in
+// the order it was sent, when clients write their commands in pieces that split
+// them at arbitrary bytes, and that a command cut off by the client hanging up is
+// dropped rather than handed over (the pool reports it as a read error). Exits
+// non-zero on a mismatch.
+//
+// Built and run from matching-engine/ by `make test`.
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "io_worker_pool.hpp"
+
+namespace {
+
+constexpr uint32_t num_sessions = 8;
+constexpr uint32_t commands_per_session = 5000;
+
+ClientCommand makeCommand(uint32_t session, uint32_t i) {
+    ClientCommand command{};
+    command.type = i % 2 ? input_buy : input_sell;
+    command.order_id = session * commands_per_session + i + 1;
+    command.price = 1000 + i % 17;
+    command.count = 1 + i % 5;
+    std::snprintf(command.instrument, sizeof(command.instrument), "S%u", session);
+    return command;
+}
+
+// writes bytes in pieces of 1 to 3 commands' worth, so most of them split a command
+void writeInPieces(int fd, const char* bytes, size_t size, std::mt19937& rng) {
+    std::uniform_int_distribution<size_t> piece(1, 3 * sizeof(ClientCommand));
+    for (size_t written = 0; written < size;) {
+        ssize_t n = write(fd, bytes + written, std::min(piece(rng), size - written));
+        if (n < 0) {
+            std::perror("write");
+            return;
+        }
+        written += n;
+        if (rng() % 8 == 0) {
+            std::this_thread::yield();
+        }
+    }
+}
+
+}  // namespace
+
+int main() {
+    std::mutex received_mut;
+    std::map<uint32_t, std::vector<ClientCommand>> received;
+    IoWorkerPool pool(2, {}, [&](std::span<ClientCommand> commands, ClientState&) {
+        std::scoped_lock lock(received_mut);
+        for (const ClientCommand& command : commands) {
+            received[(command.order_id - 1) / commands_per_session].push_back(command);
+        }
+    });
+
+    std::vector<std::thread> clients;
+    for (uint32_t session = 0; session < num_sessions; ++session) {
+        int fds[2];
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) {
+            std::perror("socketpair");
+            return 1;
+        }
+        pool.add(ClientConnection(fds[0]));
+        clients.emplace_back([session, fd = fds[1]] {
+            std::vector<ClientCommand> commands;
+            for (uint32_t i = 0; i < commands_per_session; ++i) {
+                commands.push_back(makeCommand(session, i));
+            }
+            std::mt19937 rng(session + 1);
+            writeInPieces(fd, reinterpret_cast<const char*>(commands.data()),
+                          commands.size() * sizeof(ClientCommand), rng);
+            // the last session hangs up in the middle of one more command
+            if (session == num_sessions - 1) {
+                ClientCommand cut_off = makeCommand(session, commands_per_session);
+                writeInPieces(fd, reinterpret_cast<const char*>(&cut_off), sizeof(cut_off) / 2, rng);
+            }
+            close(fd);
+        });
+    }
+    for (std::thread& client : clients) {
+        client.join();
+    }
+    pool.drain();
+
+    bool ok = true;
+    for (uint32_t session = 0; session < num_sessions; ++session) {
+        const std::vector<ClientCommand>& commands = received[session];
+        bool match = commands.size() == commands_per_session;
+        for (uint32_t i = 0; match && i < commands_per_session; ++i) {
+            ClientCommand expected = makeCommand(session, i);
+            match = std::memcmp(&commands[i], &expected, sizeof(expected)) == 0;
+        }
+        if (!match) {
+            std::fprintf(stderr, "session %u: %zu commands received, expected %u in order\n", session,
+                         commands.size(), commands_per_session);
+            ok = false;
+        }
+    }
+    std::fprintf(stderr, "%u sessions, %s\n", num_sessions, ok ? "all commands in order" : "MISMATCH");
+    return ok ? 0 : 1;
+}
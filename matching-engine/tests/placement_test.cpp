@@ -0,0 +1,202 @@
+// Checks that NUMA placement falls back sensibly on a host without NUMA: sysfs
+// trees with no node directory, no node entries, or nodes holding none of the
+// allowed cpus all yield one node with every allowed cpu; spread() still puts
+// whole cores before SMT siblings; matchers on that node, and unpinned ones when
+// there are fewer cpus than matchers, still get instruments assigned and moved;
+// and an engine with placement and rebalancing on matches on this host. Exits
+// non-zero on a failure.
+//
+// Built and run from matching-engine/ by `make test`.
+
+#include <sched.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "engine.hpp"
+#include "placement.hpp"
+
+namespace {
+
+bool ok = true;
+
+void check(bool condition, const char* what) {
+    std::fprintf(stderr, "%s: %s\n", what, condition ? "ok" : "FAILED");
+    ok &= condition;
+}
+
+std::vector<int> allowedCpus() {
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    std::vector<int> cpus;
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) == 0) {
+        for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+            if (CPU_ISSET(cpu, &allowed)) {
+                cpus.push_back(cpu);
+            }
+        }
+    }
+    return cpus;
+}
+
+void writeFile(const std::filesystem::path& path, const std::string& line) {
+    std::filesystem::create_directories(path.parent_path());
+    std::ofstream(path) << line << "\n";
+}
+
+// a sysfs tree without NUMA nodes where the given cpus pair up as SMT siblings
+std::filesystem::path makeSysfs(const std::filesystem::path& root, const std::vector<int>& cpus) {
+    for (size_t i = 0; i < cpus.size(); ++i) {
+        size_t first = i - i % 2;
+        std::string siblings = std::to_string(cpus[first]);
+        if (first + 1 < cpus.size()) {
+            siblings += "," + std::to_string(cpus[first + 1]);
+        }
+        writeFile(root / "cpu" / ("cpu" + std::to_string(cpus[i])) / "topology" / "thread_siblings_list", siblings);
+    }
+    return root;
+}
+
+bool isFallback(const CpuTopology& topology, const std::vector<int>& cpus) {
+    return topology.nodes.size() == 1 && topology.nodes[0] == cpus;
+}
+
+void checkTopology(const std::filesystem::path& scratch, const std::vector<int>& cpus) {
+    std::filesystem::path no_node_dir = makeSysfs(scratch / "no_node_dir", cpus);
+    CpuTopology topology = CpuTopology::detect(no_node_dir);
+    check(isFallback(topology, cpus), "no node directory: one node with every allowed cpu");
+
+    std::filesystem::path no_nodes = makeSysfs(scratch / "no_nodes", cpus);
+    writeFile(no_nodes / "node" / "possible", "0");
+    check(isFallback(CpuTopology::detect(no_nodes), cpus), "no node entries: one node with every allowed cpu");
+
+    std::filesystem::path foreign_nodes = makeSysfs(scratch / "foreign_nodes", cpus);
+    writeFile(foreign_nodes / "node" / "node0" / "cpulist", std::to_string(CPU_SETSIZE) + "-" + std::to_string(CPU_SETSIZE + 1));
+    check(isFallback(CpuTopology::detect(foreign_nodes), cpus), "no allowed cpu on any node: one node with every allowed cpu");
+
+    std::vector<int> expected_spread;
+    for (size_t i = 0; i < cpus.size(); i += 2) {
+        expected_spread.push_back(cpus[i]);
+    }
+    for (size_t i = 1; i < cpus.size(); i += 2) {
+        expected_spread.push_back(cpus[i]);
+    }
+    check(topology.spread(cpus.size() + 4) == expected_spread, "spread: whole cores first, at most every allowed cpu");
+    // the same on a node of two cores whatever this host has
+    CpuTopology two_cores;
+    two_cores.nodes = {{0, 1, 2, 3}};
+    two_cores.sysfs_root = makeSysfs(scratch / "two_cores", {0, 1, 2, 3});
+    check(two_cores.spread(3) == std::vector<int>{0, 2, 1}, "spread on two cores: both cores before a sibling");
+    check(topology.nodeOf(cpus.front()) == 0 && topology.nodeOf(CPU_SETSIZE) == -1, "nodeOf on the fallback node");
+
+    std::vector<int> host_cpus;
+    for (const std::vector<int>& node_cpus : CpuTopology::detect().nodes) {
+        host_cpus.insert(host_cpus.end(), node_cpus.begin(), node_cpus.end());
+    }
+    std::sort(host_cpus.begin(), host_cpus.end());
+    check(host_cpus == cpus, "this host: the nodes hold every allowed cpu once");
+}
+
+// the way the engine places matchers: one per spread cpu, the rest unpinned
+void checkPlacement(const CpuTopology& topology) {
+    constexpr uint32_t num_matchers = 4;
+    std::vector<int> cpus = topology.spread(num_matchers);
+    std::vector<int> matcher_nodes;
+    for (uint32_t i = 0; i < num_matchers; ++i) {
+        matcher_nodes.push_back(i < cpus.size() ? topology.nodeOf(cpus[i]) : -1);
+    }
+    InstrumentPlacement placement(matcher_nodes);
+
+    std::vector<uint32_t> owners;
+    std::vector<uint32_t> per_matcher(num_matchers, 0);
+    for (uint32_t instrument_id = 0; instrument_id < 3 * num_matchers; ++instrument_id) {
+        owners.push_back(placement.assign());
+        ++per_matcher[owners.back()];
+    }
+    check(per_matcher == std::vector<uint32_t>(num_matchers, 3), "assign: instruments evenly over the matchers");
+
+    std::vector<uint64_t> loads(owners.size(), 10);
+    for (uint32_t instrument_id = 0; instrument_id < owners.size(); ++instrument_id) {
+        if (owners[instrument_id] == 0) {
+            loads[instrument_id] = 100;
+        }
+    }
+    std::optional<InstrumentPlacement::Move> move = placement.plan(loads, owners, 0.25);
+    check(move && move->from == 0 && move->to != 0 && owners[move->instrument_id] == 0,
+          "plan: an instrument moves off the busiest matcher");
+    if (move) {
+        placement.moved(*move);
+        owners[move->instrument_id] = move->to;
+    }
+    check(!placement.plan(std::vector<uint64_t>(owners.size(), 10), owners, 0.25), "plan: nothing moves when balanced");
+}
+
+void count(const EventRecord& record, void* context) {
+    static std::mutex mut;
+    std::scoped_lock lock(mut);
+    ++static_cast<std::vector<uint32_t>*>(context)->at(static_cast<size_t>(record.type));
+}
+
+void checkEngine() {
+    constexpr uint32_t num_instruments = 16;
+    std::vector<uint32_t> events(3, 0);
+    EventJournal::redirect(count, &events);
+    {
+        EngineConfig config;
+        config.mode = EngineConfig::Mode::SingleWriter;
+        config.num_matchers = 3;
+        config.numa_placement = true;
+        config.rebalance_interval = std::chrono::milliseconds(1);
+        Engine engine(config);
+        ClientState client;
+        for (uint32_t round = 0; round < 200; ++round) {
+            for (uint32_t instrument = 0; instrument < num_instruments; ++instrument) {
+                ClientCommand commands[2] = {};
+                for (ClientCommand& command : commands) {
+                    std::snprintf(command.instrument, sizeof(command.instrument), "NUMA%u", instrument);
+                    command.price = 100;
+                    command.count = 1;
+                }
+                commands[0].type = input_buy;
+                commands[0].order_id = 2 * (round * num_instruments + instrument) + 1;
+                commands[1].type = input_sell;
+                commands[1].order_id = commands[0].order_id + 1;
+                engine.submit(commands, client);
+            }
+        }
+        engine.drain();
+    }
+    EventJournal::redirect(nullptr, nullptr);
+
+    constexpr uint32_t pairs = 200 * num_instruments;
+    check(events[static_cast<size_t>(EventType::OrderAdded)] == pairs &&
+              events[static_cast<size_t>(EventType::OrderExecuted)] == pairs &&
+              events[static_cast<size_t>(EventType::OrderDeleted)] == 0,
+          "engine with placement and rebalancing: every buy rests and is filled");
+}
+
+}  // namespace
+
+int main() {
+    std::vector<int> cpus = allowedCpus();
+    if (cpus.empty()) {
+        std::fprintf(stderr, "cannot read the allowed cpus\n");
+        return 1;
+    }
+    std::filesystem::path scratch =
+        std::filesystem::temp_directory_path() / ("placement_test." + std::to_string(getpid()));
+    checkTopology(scratch, cpus);
+    checkPlacement(CpuTopology::detect(scratch / "no_node_dir"));
+    std::filesystem::remove_all(scratch);
+    checkEngine();
+    return ok ? 0 : 1;
+}
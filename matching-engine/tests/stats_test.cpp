@@ -0,0 +1,121 @@
+// Checks the liveness and hot path counters against a workload whose outcome is
+// known: 100 buys rest, 30 of them are cancelled, cancels of unknown or already
+// cancelled ids are rejected, and sells fill 20 buys completely and one partly.
+// Run in locked and in single-writer mode; the directory and the hot path
+// counters are process wide, so each run checks how much they moved. Exits
+// non-zero on a mismatch.
+//
+// Built and run from matching-engine/ by `make test`.
+
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#include "engine.hpp"
+#include "hot_path_stats.hpp"
+
+namespace {
+
+constexpr uint32_t ids_per_run = 1000;
+
+struct Expected {
+    const char* name;
+    uint64_t value;
+    uint64_t actual;
+};
+
+ClientCommand makeCommand(CommandType type, uint32_t order_id, uint32_t price, uint32_t count) {
+    ClientCommand command{};
+    command.type = type;
+    command.order_id = order_id;
+    command.price = price;
+    command.count = count;
+    std::strcpy(command.instrument, "STATS");
+    return command;
+}
+
+std::vector<ClientCommand> makeWorkload(uint32_t id_offset) {
+    std::vector<ClientCommand> commands;
+    for (uint32_t id = 1; id <= 100; ++id) {
+        commands.push_back(makeCommand(input_buy, id_offset + id, 100, 10));
+    }
+    for (uint32_t id = 71; id <= 100; ++id) {
+        commands.push_back(makeCommand(input_cancel, id_offset + id, 0, 0));
+    }
+    // already cancelled, then never seen
+    for (uint32_t id = 71; id <= 75; ++id) {
+        commands.push_back(makeCommand(input_cancel, id_offset + id, 0, 0));
+    }
+    for (uint32_t id = 900; id < 903; ++id) {
+        commands.push_back(makeCommand(input_cancel, id_offset + id, 0, 0));
+    }
+    // fills buys 1-10, then 11-20 and half of 21
+    commands.push_back(makeCommand(input_sell, id_offset + 201, 100, 100));
+    commands.push_back(makeCommand(input_sell, id_offset + 202, 100, 105));
+    // crosses nothing and does not rest
+    commands.push_back(makeCommand(input_sell_ioc, id_offset + 203, 101, 10));
+    return commands;
+}
+
+void discard(const EventRecord&, void*) {}
+
+uint64_t counter(const HotPathStatsSnapshot& stats, HotPathCounter counter) {
+    return stats.totals[static_cast<size_t>(counter)];
+}
+
+bool runWorkload(const char* name, EngineConfig::Mode mode, uint32_t id_offset) {
+    std::vector<ClientCommand> commands = makeWorkload(id_offset);
+    OrderIndexStats directory_before = InstrumentOrders::directory_stats();
+    HotPathStatsSnapshot hot_path_before = HotPathStats::snapshot();
+
+    EngineConfig config;
+    config.mode = mode;
+    config.num_matchers = 2;
+    Engine engine(config);
+    ClientState client;
+    for (ClientCommand& command : commands) {
+        engine.submit(std::span(&command, 1), client);
+    }
+    engine.drain();
+
+    OrderStateStats state = engine.order_state_stats();
+    HotPathStatsSnapshot hot_path = engine.hot_path_stats();
+    const Expected checks[] = {
+        {"books.live", 50, state.books.live},
+        {"books.retired", 50, state.books.retired},
+        {"directory.live", 50, state.directory.live - directory_before.live},
+        // the cancelled and filled buys, and both sells once filled
+        {"directory.retired", 52, state.directory.retired - directory_before.retired},
+        {"orders", 103, counter(hot_path, HotPathCounter::Orders) - counter(hot_path_before, HotPathCounter::Orders)},
+        {"rested", 100, counter(hot_path, HotPathCounter::Rested) - counter(hot_path_before, HotPathCounter::Rested)},
+        {"fills", 21, counter(hot_path, HotPathCounter::Fills) - counter(hot_path_before, HotPathCounter::Fills)},
+        {"sweeps", 2, counter(hot_path, HotPathCounter::Sweeps) - counter(hot_path_before, HotPathCounter::Sweeps)},
+        {"cancels_accepted", 30,
+         counter(hot_path, HotPathCounter::CancelsAccepted) - counter(hot_path_before, HotPathCounter::CancelsAccepted)},
+        {"cancels_rejected", 8,
+         counter(hot_path, HotPathCounter::CancelsRejected) - counter(hot_path_before, HotPathCounter::CancelsRejected)},
+    };
+
+    bool ok = true;
+    for (const Expected& check : checks) {
+        if (check.actual != check.value) {
+            std::fprintf(stderr, "%s: %s is %llu, expected %llu\n", name, check.name,
+                         static_cast<unsigned long long>(check.actual), static_cast<unsigned long long>(check.value));
+            ok = false;
+        }
+    }
+    if (ok) {
+        std::fprintf(stderr, "%s: all counters as expected\n", name);
+    }
+    return ok;
+}
+
+}  // namespace
+
+int main() {
+    EventJournal::redirect(discard, nullptr);
+    bool ok = runWorkload("locked", EngineConfig::Mode::Locked, 0);
+    ok = runWorkload("single writer", EngineConfig::Mode::SingleWriter, ids_per_run) && ok;
+    EventJournal::redirect(nullptr, nullptr);
+    return ok ? 0 : 1;
+}
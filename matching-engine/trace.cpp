@@ -0,0 +1,50 @@
+#include "trace.hpp"
+
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace {
+
+struct ThreadTraceBuffer {
+    std::unique_ptr<TraceRecord[]> records{new TraceRecord[Trace::records_per_thread]};
+    // total records ever written by the thread
+    uint64_t written = 0;
+};
+
+std::mutex buffers_mut;
+// buffers stay alive after their thread exits so they can still be dumped
+std::vector<std::shared_ptr<ThreadTraceBuffer>> buffers;
+
+thread_local std::shared_ptr<ThreadTraceBuffer> thread_buffer;
+
+}  // namespace
+
+void Trace::record(TraceLevel level, TraceEvent event, uint32_t order_id, uint32_t arg) {
+    if (!thread_buffer) {
+        thread_buffer = std::make_shared<ThreadTraceBuffer>();
+        std::scoped_lock lock(buffers_mut);
+        buffers.push_back(thread_buffer);
+    }
+    ThreadTraceBuffer& buffer = *thread_buffer;
+    TraceRecord& record = buffer.records[buffer.written % records_per_thread];
+    record.timestamp = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                           std::chrono::steady_clock::now().time_since_epoch())
+                           .count();
+    record.order_id = order_id;
+    record.arg = arg;
+    record.event = event;
+    record.level = level;
+    ++buffer.written;
+}
+
+// not synchronised with tracing threads, meant for after they are done or for debugging
+void Trace::dump(FILE* file) {
+    std::scoped_lock lock(buffers_mut);
+    for (auto& buffer : buffers) {
+        uint64_t first = buffer->written > records_per_thread ? buffer->written - records_per_thread : 0;
+        for (uint64_t i = first; i < buffer->written; ++i) {
+            fwrite(&buffer->records[i % records_per_thread], sizeof(TraceRecord), 1, file);
+        }
+    }
+}
@@ -0,0 +1,65 @@
+#ifndef TRACE_HPP
+#define TRACE_HPP
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+
+// Leveled trace points for the matching path.
+//
+// ENGINE_TRACE(level, event, order_id, arg) compiles to nothing unless level is at
+// most ENGINE_TRACE_LEVEL (0 by default, so release builds carry no tracing at
+// all and the arguments are never evaluated). Enabled trace points append a
+// fixed-size binary TraceRecord to a buffer owned by the calling thread, without
+// any lock or formatting; Trace::dump() writes all buffers out afterwards.
+//
+//   g++ -DENGINE_TRACE_LEVEL=3 ...     // trace everything up to TraceLevel::Debug
+
+#ifndef ENGINE_TRACE_LEVEL
+#define ENGINE_TRACE_LEVEL 0
+#endif
+
+enum class TraceLevel : uint8_t {
+    Error = 1,
+    Info = 2,
+    Debug = 3,
+};
+
+enum class TraceEvent : uint8_t {
+    MatchStarted,
+    NotTransactionable,
+    AddRaced,
+    Executing,
+    OrderRested,
+    CancelReceived,
+};
+
+struct TraceRecord {
+    int64_t timestamp;
+    uint32_t order_id;
+    // event specific: resting order id for Executing, price levels for OrderRested
+    uint32_t arg;
+    TraceEvent event;
+    TraceLevel level;
+};
+
+class Trace {
+   public:
+    // number of records kept per thread, older records are overwritten
+    static constexpr size_t records_per_thread = 1 << 16;
+
+    static void record(TraceLevel level, TraceEvent event, uint32_t order_id, uint32_t arg);
+
+    // writes the retained records of every thread that traced as raw TraceRecords,
+    // each thread's records in order
+    static void dump(FILE* file);
+};
+
+#define ENGINE_TRACE(level, event, order_id, arg)                                   \
+    do {                                                                            \
+        if constexpr (static_cast<int>(level) <= ENGINE_TRACE_LEVEL) {              \
+            Trace::record((level), (event), (order_id), (arg));                     \
+        }                                                                           \
+    } while (0)
+
+#endif
@@ -0,0 +1,181 @@
+#include "write_ahead_log.hpp"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "spsc_ring.hpp"
+
+namespace {
+
+struct ProducerRing {
+    SpscRing<WalRecord> ring;
+    // set once the producing thread exited, the writer frees the ring after draining it
+    std::atomic<bool> retired{false};
+
+    explicit ProducerRing(size_t capacity) : ring(capacity) {}
+};
+
+struct LogState {
+    WriteAheadLog::Options options;
+    std::atomic<bool> stopping{false};
+    std::thread writer;
+    int fd = -1;
+
+    std::mutex rings_mut;
+    std::vector<std::shared_ptr<ProducerRing>> rings;
+
+    // rotation handshake with the writer
+    std::mutex rotate_mut;
+    std::condition_variable rotate_cv;
+    bool rotate_requested = false;
+    uint64_t segment = 0;
+};
+
+LogState state;
+
+struct ThreadRing {
+    std::shared_ptr<ProducerRing> ring;
+
+    ~ThreadRing() {
+        if (ring) {
+            ring->retired.store(true, std::memory_order_release);
+        }
+    }
+};
+
+thread_local ThreadRing thread_ring;
+
+int openSegment(uint64_t segment) {
+    std::string path = WriteAheadLog::segmentPath(state.options.dir, segment);
+    int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        SyncCerr() << "Failed to open write-ahead log " << path << std::endl;
+    }
+    return fd;
+}
+
+void writeAll(const WalRecord* records, size_t num_records) {
+    const char* data = reinterpret_cast<const char*>(records);
+    size_t remaining = num_records * sizeof(WalRecord);
+    while (remaining > 0 && state.fd >= 0) {
+        ssize_t written = ::write(state.fd, data, remaining);
+        if (written < 0) {
+            SyncCerr() << "Failed to write write-ahead log" << std::endl;
+            return;
+        }
+        data += written;
+        remaining -= written;
+    }
+}
+
+// drains every ring into the current segment, returns false if there was nothing
+bool flushRings(std::vector<std::shared_ptr<ProducerRing>>& rings, std::vector<WalRecord>& batch) {
+    {
+        std::scoped_lock lock(state.rings_mut);
+        std::erase_if(state.rings, [](const std::shared_ptr<ProducerRing>& ring) {
+            return ring->retired.load(std::memory_order_acquire) && ring->ring.empty();
+        });
+        rings = state.rings;
+    }
+    batch.clear();
+    WalRecord record;
+    for (auto& ring : rings) {
+        while (ring->ring.tryPop(record)) {
+            batch.push_back(record);
+        }
+    }
+    if (batch.empty()) {
+        return false;
+    }
+    writeAll(batch.data(), batch.size());
+    return true;
+}
+
+void writerLoop() {
+    std::vector<std::shared_ptr<ProducerRing>> rings;
+    std::vector<WalRecord> batch;
+    while (true) {
+        // read before draining, so everything appended before stop() is written
+        bool stopping = state.stopping.load(std::memory_order_acquire);
+        bool wrote = false;
+        while (flushRings(rings, batch)) {
+            wrote = true;
+        }
+        if (wrote && state.fd >= 0) {
+            fdatasync(state.fd);
+        }
+
+        {
+            std::scoped_lock lock(state.rotate_mut);
+            if (state.rotate_requested) {
+                // everything pushed before the request was drained above
+                if (state.fd >= 0) {
+                    ::close(state.fd);
+                }
+                state.fd = openSegment(++state.segment);
+                state.rotate_requested = false;
+                state.rotate_cv.notify_all();
+            }
+        }
+
+        if (stopping) {
+            return;
+        }
+        std::this_thread::sleep_for(state.options.flush_interval);
+    }
+}
+
+}  // namespace
+
+std::string WriteAheadLog::segmentPath(const std::string& dir, uint64_t segment) {
+    return dir + "/wal." + std::to_string(segment);
+}
+
+void WriteAheadLog::start(const Options& options) {
+    if (running.load()) {
+        return;
+    }
+    state.options = options;
+    state.segment = options.first_segment;
+    state.fd = openSegment(state.segment);
+    state.stopping.store(false);
+    state.writer = std::thread(writerLoop);
+    running.store(true);
+}
+
+void WriteAheadLog::stop() {
+    if (!running.exchange(false)) {
+        return;
+    }
+    state.stopping.store(true, std::memory_order_release);
+    state.writer.join();
+    if (state.fd >= 0) {
+        ::close(state.fd);
+        state.fd = -1;
+    }
+}
+
+void WriteAheadLog::append(const WalRecord& record) {
+    ThreadRing& local = thread_ring;
+    if (!local.ring) {
+        local.ring = std::make_shared<ProducerRing>(state.options.ring_capacity);
+        std::scoped_lock lock(state.rings_mut);
+        state.rings.push_back(local.ring);
+    }
+    while (!local.ring->ring.tryPush(record)) {
+        std::this_thread::yield();
+    }
+}
+
+uint64_t WriteAheadLog::rotate() {
+    std::unique_lock<std::mutex> lock(state.rotate_mut);
+    state.rotate_requested = true;
+    state.rotate_cv.wait(lock, [] { return !state.rotate_requested; });
+    return state.segment;
+}
@@ -0,0 +1,75 @@
+#ifndef WRITE_AHEAD_LOG_HPP
+#define WRITE_AHEAD_LOG_HPP
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+#include "io.hpp"
+
+enum class WalOp : uint8_t {
+    // an order was added to the book with count
+    Rested,
+    // count of a resting order was executed
+    Filled,
+    // a resting order was cancelled
+    Removed,
+    // a resting order was amended to price and count; it keeps its place if only its
+    // count went down, otherwise it moves to the back of its new level
+    Amended,
+};
+
+// One change to one book. Records of a book are numbered by book_sequence
+// without gaps, in the order the changes were made; records of different books
+// are unordered.
+struct WalRecord {
+    uint64_t book_sequence;
+    // not NUL terminated when 8 characters long
+    char instrument[8];
+    uint32_t order_id;
+    uint32_t price;
+    uint32_t count;
+    WalOp op;
+    // CommandType of the book, narrowed to a byte
+    uint8_t side;
+};
+
+static_assert(sizeof(WalRecord) == 32);
+
+// Append-only log of book changes, written as segment files wal.<n> in a directory.
+//
+// append() only copies the record into a ring owned by the calling thread; a
+// background thread drains all rings, writes what it found in one write() and
+// makes it durable with one fdatasync() per flush interval (group commit). So a
+// crash loses at most the last interval, and since each book's records are
+// numbered, recovery only applies the gap-free prefix of every book.
+class WriteAheadLog {
+   public:
+    struct Options {
+        std::string dir;
+        uint64_t first_segment = 0;
+        std::chrono::microseconds flush_interval{1000};
+        // per producing thread, must be a power of two
+        size_t ring_capacity = 1 << 14;
+    };
+
+    static void start(const Options& options);
+    // writes and syncs every record appended so far, then joins the writer
+    static void stop();
+
+    static bool enabled() { return running.load(std::memory_order_relaxed); }
+    static void append(const WalRecord& record);
+
+    // Starts a new segment and returns its number once the writer switched to
+    // it. Every record in an older segment was appended before rotate()
+    // returned, so a snapshot of the books taken afterwards covers all of them.
+    static uint64_t rotate();
+
+    static std::string segmentPath(const std::string& dir, uint64_t segment);
+
+   private:
+    static inline std::atomic<bool> running{false};
+};
+
+#endif